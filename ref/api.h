@@ -13,6 +13,19 @@
 #define CRYPTO_BYTES SPX_BYTES
 #define CRYPTO_SEEDBYTES (5*SPX_N)
 
+/*
+ * The private key format.  The PRF tree (which derives all the secret
+ * values from SK_SEED) is either SHAKE128 (format 1) or TurboSHAKE128
+ * (format 2, built with PRF=turboshake128).  The public key and signatures
+ * are standard either way; however a private key only works with the
+ * format it was generated with
+ */
+#if defined(SPX_PRF_TURBOSHAKE128)
+#define CRYPTO_KEYFORMAT 2
+#else
+#define CRYPTO_KEYFORMAT 1
+#endif
+
 /*
  * Returns the length of a secret key, in bytes
  */
@@ -33,6 +46,11 @@ unsigned long long crypto_sign_bytes(void);
  */
 unsigned long long crypto_sign_seedbytes(void);
 
+/*
+ * Returns the private key format (see CRYPTO_KEYFORMAT)
+ */
+unsigned long long crypto_sign_keyformat(void);
+
 /*
  * Generates a SPHINCS+ key pair given a seed.
  * Format sk: [SK_SEED || SK_PRF || PUB_SEED || root]
@@ -50,6 +68,8 @@ int crypto_sign_keypair(unsigned char *pk, unsigned char *sk);
 
 /**
  * Returns an array containing a detached signature.
+ * Returns 0 on success, -1 if a fault was detected, or if the private key is
+ * not of this build's key format (in which case no signature is released)
  */
 int crypto_sign_signature(uint8_t *sig, size_t *siglen,
                           const uint8_t *m, size_t mlen, const uint8_t *sk);
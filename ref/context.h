@@ -5,6 +5,9 @@
 
 #include "params.h"
 
+/* What an abandoned signing or key generation returns */
+#define SPX_CANCELLED (-2)
+
 typedef struct {
     uint8_t pub_seed[SPX_N];
     uint8_t sk_seed[3*SPX_N];
@@ -18,6 +21,14 @@ typedef struct {
     /* The seed we use to derive the FORS prf values */
     unsigned char fors_seed[3*SPX_N];
 
+    /* If nonzero, an int that another thread may set (to nonzero) to */
+    /* abandon the signing or key generation using this context */
+    const int *cancel;
+
+    /* If nonzero, the thread that expands PRF trees for the signing or */
+    /* key generation using this context (see create_prf_pipeline) */
+    struct prf_pipeline *prf_pipeline;
+
 #ifdef SPX_SHA2
     // sha256 state that absorbed pub_seed
     uint8_t state_seeded[40];
@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "params.h"
+#include "f-threshold.h"
+#include "f-coalesce.h"
+
+/*
+ * What a caller of coalesce_f_chains puts on the shared list; it lives in
+ * that caller's frame.  Jobs are claimed (by the owner, or by another
+ * thread with spare lanes) by bumping next; anyone other than the owner
+ * only touches the batch while holding batch_lock, and the owner takes the
+ * batch off the list (under the lock) before it returns
+ */
+struct f_coalesce_batch {
+    struct f_job *jobs;
+    unsigned count;
+    unsigned next;           /* The next job to claim */
+    unsigned remaining;      /* Jobs not yet finished */
+    struct f_coalesce_batch *prev, *next_batch;
+};
+
+/* The batches of the threads currently in coalesce_f_chains */
+static struct f_coalesce_batch *batches;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void set_up_f_job( struct f_job *job, const unsigned char *prf_output,
+                   unsigned steps, unsigned capture, uint64_t *captured,
+                   const spx_ctx *ctx, uint32_t addr[8] )
+{
+    job->value_offset = set_up_f_block( job->chain_state, prf_output,
+                                        ctx, addr );
+    job->steps = steps;
+    job->capture = capture;
+    job->captured = captured;
+}
+
+/*
+ * Do the bookkeeping for a job that has just reached step k: capture the
+ * value if it's the one that was asked for.  Returns 1 if it's at the top
+ */
+static int settle_job( struct f_job *job )
+{
+    const uint64_t *value = &job->chain_state[job->value_offset];
+
+    if (job->k == job->capture) {
+        memcpy( &job->captured[0], &value[0], SPX_N );
+        if (job->k < job->steps) {
+            /* In the middle of the chain; keep all the shares */
+            memcpy( &job->captured[SPX_N/8], &value[25], SPX_N );
+            memcpy( &job->captured[2*SPX_N/8], &value[50], SPX_N );
+        } else {
+            /* At the top, the value is unblinded */
+            memset( &job->captured[SPX_N/8], 0, 2*SPX_N );
+        }
+    }
+    return job->k == job->steps;
+}
+
+/*
+ * Claim the next unclaimed job of b; returns 0 if they've all been taken
+ */
+static struct f_job *claim_job( struct f_coalesce_batch *b )
+{
+    unsigned i;
+
+    if (__atomic_load_n( &b->next, __ATOMIC_RELAXED ) >= b->count) return 0;
+    i = __atomic_fetch_add( &b->next, 1, __ATOMIC_RELAXED );
+    if (i >= b->count) return 0;
+    b->jobs[i].batch = b;
+    b->jobs[i].k = 0;
+    return &b->jobs[i];
+}
+
+/*
+ * Put a claimed job in a lane; returns 0 if it's done already (a chain
+ * with no steps)
+ */
+static struct f_job *load_lane( struct f_job *job )
+{
+    if (job && settle_job( job )) {
+        __atomic_fetch_sub( &job->batch->remaining, 1, __ATOMIC_RELEASE );
+        return 0;
+    }
+    return job;
+}
+
+/*
+ * Fill up to 'want' spare lanes with other threads' jobs.  We only try
+ * the lock; if someone else holds it, we'll run with what we have
+ */
+static void steal_jobs( struct f_job *lane[4], int want,
+                        struct f_coalesce_batch *own )
+{
+    struct f_coalesce_batch *b;
+    int i = 0;
+
+    if (pthread_mutex_trylock( &batch_lock )) return;
+    for (b = batches; b && want > 0; b = b->next_batch) {
+        if (b == own) continue;
+        while (want > 0) {
+            struct f_job *job = claim_job( b );
+            if (!job) break;
+            while (lane[i]) i++;
+            lane[i] = load_lane( job );
+            if (lane[i]) want--;
+        }
+    }
+    pthread_mutex_unlock( &batch_lock );
+}
+
+void coalesce_f_chains( struct f_job *jobs, unsigned count )
+{
+    struct f_coalesce_batch batch;
+    struct f_job *lane[4] = { 0 };
+    uint64_t *state[4];
+    int keep_blinded[4];
+    int active, i;
+
+    if (count == 0) return;
+    batch.jobs = jobs;
+    batch.count = count;
+    batch.next = 0;
+    batch.remaining = count;
+
+    /* Let the other threads see our batch */
+    pthread_mutex_lock( &batch_lock );
+    batch.prev = 0;
+    batch.next_batch = batches;
+    if (batches) batches->prev = &batch;
+    batches = &batch;
+    pthread_mutex_unlock( &batch_lock );
+
+    for (;;) {
+        int own_done = __atomic_load_n( &batch.remaining,
+                                        __ATOMIC_ACQUIRE ) == 0;
+
+        /* Refill the empty lanes, from our own batch first; once that's */
+        /* done, we just finish what's in the lanes */
+        active = 0;
+        for (i=0; i<4; i++) {
+            while (!lane[i] && !own_done) {
+                struct f_job *job = claim_job( &batch );
+                if (!job) break;
+                lane[i] = load_lane( job );
+            }
+            if (lane[i]) active++;
+        }
+        if (active < 4 && !own_done) {
+            steal_jobs( lane, 4 - active, &batch );
+            for (active = 0, i = 0; i < 4; i++) {
+                if (lane[i]) active++;
+            }
+        }
+
+        if (active == 0) {
+            if (__atomic_load_n( &batch.remaining, __ATOMIC_ACQUIRE ) == 0) {
+                break;
+            }
+            /* The rest of our jobs are in other threads' lanes */
+            sched_yield();
+            continue;
+        }
+
+        /* One F step on each lane; the last step of a chain unblinds it */
+        for (i=0; i<4; i++) {
+            state[i] = lane[i] ? lane[i]->chain_state : 0;
+            keep_blinded[i] = lane[i] && lane[i]->k + 1 != lane[i]->steps;
+        }
+        if (active == 1) {
+            for (i=0; !lane[i]; i++)
+                ;
+            f_transform( state[i], keep_blinded[i] );
+        } else {
+            f_transformx4( state, keep_blinded );
+        }
+
+        for (i=0; i<4; i++) {
+            if (!lane[i]) continue;
+            increment_hash_addr_in_chain_state( lane[i]->chain_state );
+            lane[i]->k++;
+            if (settle_job( lane[i] )) {
+                /* After this, the job (and its batch) isn't ours to touch */
+                __atomic_fetch_sub( &lane[i]->batch->remaining, 1,
+                                    __ATOMIC_RELEASE );
+                lane[i] = 0;
+            }
+        }
+    }
+
+    /* Everything is done (and nobody has any of our jobs in a lane) */
+    pthread_mutex_lock( &batch_lock );
+    if (batch.prev) {
+        batch.prev->next_batch = batch.next_batch;
+    } else {
+        batches = batch.next_batch;
+    }
+    if (batch.next_batch) batch.next_batch->prev = batch.prev;
+    pthread_mutex_unlock( &batch_lock );
+}
@@ -0,0 +1,55 @@
+#if !defined( F_COALESCE_H_ )
+#define F_COALESCE_H_
+
+#include <stdint.h>
+#include "context.h"
+
+/*
+ * The F chains (the WOTS chains, and the single F of each FORS leaf) are
+ * where a signature spends its time, and each one is a string of dependent
+ * threshold Keccak permutations.  Independent chains can be run side by
+ * side with do_threshold_keccak_permutationx4; this gathers them up to do
+ * that.  A caller describes each chain it wants walked as an f_job, and
+ * hands a batch of them to coalesce_f_chains, which runs them four lanes
+ * at a time, refilling a lane as soon as its chain finishes.  The batches
+ * of all the threads currently signing are visible to each other; a thread
+ * that has fewer than four chains of its own left fills its spare lanes
+ * with chains from the others (taking at most four at a time, and only
+ * until its own batch is done).  Each thread does its own work, and
+ * returns once its own batch is done
+ *
+ * This is used only if we're built with SPX_F_COALESCE
+ */
+struct f_coalesce_batch;
+
+struct f_job {
+    uint64_t chain_state[3*25];
+    unsigned value_offset;   /* Where the running value is in chain_state */
+    unsigned steps;          /* The number of F steps to the top; the last */
+                             /* one unblinds the value */
+    unsigned capture;        /* The step whose value we want (~0 if none) */
+    uint64_t *captured;      /* Where we put it (3*SPX_N/8 words; as in */
+                             /* walk_wots_chain, still blinded) */
+
+    /* The rest is ours */
+    unsigned k;              /* The step we're at */
+    struct f_coalesce_batch *batch;
+};
+
+/*
+ * Set up a job to walk a chain of steps F's from the (threshold format) PRF
+ * output, at the address addr
+ */
+#define set_up_f_job SPX_NAMESPACE(set_up_f_job)
+void set_up_f_job( struct f_job *job, const unsigned char *prf_output,
+                   unsigned steps, unsigned capture, uint64_t *captured,
+                   const spx_ctx *ctx, uint32_t addr[8] );
+
+/*
+ * Walk the count chains in jobs; when this returns, the value at the top of
+ * chain i is jobs[i].chain_state[jobs[i].value_offset] (unblinded)
+ */
+#define coalesce_f_chains SPX_NAMESPACE(coalesce_f_chains)
+void coalesce_f_chains( struct f_job *jobs, unsigned count );
+
+#endif /* F_COALESCE_H_ */
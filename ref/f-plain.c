@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "address.h"
+#include "params.h"
+#include "f-plain.h"
+#include "f-threshold.h"
+#include "fips202.h"
+
+/*
+ * This is the code that implements the (unmasked) F and H functions on
+ * the verification path.  It is the public counterpart of f-threshold.c:
+ * when the input fits within a single SHAKE256 block (which is always true
+ * for F and H), we can lay out PK.seed, ADRS, the input and the padding
+ * directly as Keccak lanes, and then hash by doing a single permutation.
+ *
+ * The caller keeps that state around as a template; between hashes, it
+ * need update only the lanes that change (the hash address within a WOTS
+ * chain, or the tree height/index for an authentication path), and the
+ * value lanes (which are usually the previous output, and so never leave
+ * the lane format).  The conversions to and from lanes are the ones
+ * f-threshold.c uses
+ */
+
+/* The size of a hash (in uint64_t's) */
+#define N (SPX_N/8)
+
+/*
+ * This sets up the template state to hash inblocks (1 or 2) n-byte blocks
+ * with the address addr.  The blocks themselves are filled in with
+ * set_plain_value
+ */
+void set_up_plain_block( uint64_t *state, const spx_ctx *ctx,
+                         const uint32_t addr[8], unsigned inblocks )
+{
+    memset( state, 0, 25 * sizeof(uint64_t) );
+
+    /* Fill in the public seed (PK.seed) */
+    transform_f( &state[0], ctx->pub_seed, SPX_N );
+
+    /* Fill in the ADRS structure */
+    transform_f( &state[N], addr, 32 );
+
+    /* Fill in the SHAKE256 padding */
+    state[PLAIN_VALUE_OFFSET + inblocks*N] = 0x1f; /* Marker at the end */
+                                                    /* of the data */
+    state[16] ^= (1ULL << 63); /* Marker at the end of the rate */
+}
+
+/*
+ * Place block number 'block' of the input into the template state
+ */
+void set_plain_value( uint64_t *state, unsigned block,
+                      const unsigned char *value )
+{
+    transform_f( &state[PLAIN_VALUE_OFFSET + block*N], value, SPX_N );
+}
+
+/*
+ * Reload the ADRS lane that holds the chain/hash address (for WOTS) or the
+ * tree height/index (for Merkle and FORS trees) from addr
+ */
+void update_plain_tree_addr( uint64_t *state, const uint32_t addr[8] )
+{
+    transform_f( &state[N + 3], (const unsigned char *)addr + 24, 8 );
+}
+
+/*
+ * This reaches into the hash address field of the ADRS structure within the
+ * template, and increments it (setting things up for the next F evaluation)
+ */
+void increment_hash_addr_in_plain_block( uint64_t *state )
+{
+    state[N + (SPX_OFFSET_HASH_ADDR/8)] +=
+	                              1ULL << (8*(SPX_OFFSET_HASH_ADDR%8));
+}
+
+/*
+ * Hash the template state, writing the n-byte result (in lane format) to
+ * output.  The template is not modified (unless output points into it, as
+ * it does when we walk a chain)
+ */
+void plain_hash( uint64_t *output, const uint64_t *state )
+{
+    uint64_t s[25];
+
+    memcpy( s, state, sizeof s );
+    KeccakF1600_StatePermute( s );
+    memcpy( output, s, SPX_N );
+}
@@ -0,0 +1,44 @@
+#if !defined( F_PLAIN_H_ )
+#define F_PLAIN_H_
+
+#include <stdint.h>
+#include "context.h"
+
+/* The offset (in uint64_t's) of the first input block within the state */
+#define PLAIN_VALUE_OFFSET (SPX_N/8 + 32/8)
+
+/*
+ * Set up a template SHAKE256 state for hashing inblocks (1 or 2) n-byte
+ * blocks under the address addr
+ */
+#define set_up_plain_block SPX_NAMESPACE(set_up_plain_block)
+void set_up_plain_block( uint64_t *state, const spx_ctx *ctx,
+                         const uint32_t addr[8], unsigned inblocks );
+
+/*
+ * Place block number 'block' of the input into the template
+ */
+#define set_plain_value SPX_NAMESPACE(set_plain_value)
+void set_plain_value( uint64_t *state, unsigned block,
+                      const unsigned char *value );
+
+/*
+ * Reload the ADRS lane holding the tree height and index from addr
+ */
+#define update_plain_tree_addr SPX_NAMESPACE(update_plain_tree_addr)
+void update_plain_tree_addr( uint64_t *state, const uint32_t addr[8] );
+
+/*
+ * Increment the hash address in the template
+ */
+#define increment_hash_addr_in_plain_block SPX_NAMESPACE(increment_hash_addr_in_plain_block)
+void increment_hash_addr_in_plain_block( uint64_t *state );
+
+/*
+ * Hash the template state; write the n-byte result (as lanes) to output
+ * (untransform_f converts it back into bytes)
+ */
+#define plain_hash SPX_NAMESPACE(plain_hash)
+void plain_hash( uint64_t *output, const uint64_t *state );
+
+#endif
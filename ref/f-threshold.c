@@ -36,9 +36,10 @@
 
 /*
  * Convert a bytestring into a uint64_t format (which is what our Keccak
- * permutation actually uses)
+ * permutation actually uses).  f-plain.c uses this (and untransform_f) for
+ * its lanes also
  */
-static void transform_f( uint64_t *output, const void *input, int num_bytes )
+void transform_f( uint64_t *output, const void *input, int num_bytes )
 {
     const unsigned char *in = input;
     for (; num_bytes > 0; num_bytes -= 8) {
@@ -68,6 +69,44 @@ void untransform_f( unsigned char *result, const uint64_t *encoded )
     }
 }
 
+/*
+ * Unblind count values, each held as 3 shares of N words (so value i is
+ * shares[3*N*i .. 3*N*i+3*N-1]), and write them out as consecutive SPX_N
+ * byte strings.  This works a word at a time, and the loop has no
+ * dependencies between words, so the compiler is free to vectorize it
+ */
+void unmask_f_values( unsigned char *result, const uint64_t *shares,
+	              unsigned count )
+{
+    for (unsigned i=0; i<count; i++, shares += 3*N) {
+	for (int j=0; j<N; j++) {
+	    uint64_t val = shares[j] ^ shares[j + N] ^ shares[j + 2*N];
+	    for (int k=0; k<8; k++) {
+	        result[k] = (unsigned char)(val >> (8*k));
+	    }
+	    result += 8;
+	}
+    }
+}
+
+/*
+ * Unblind a PRF output (3 shares of SPX_N bytes, as the PRF tree produces
+ * them) into the SPX_N byte value.  This works a word at a time (the
+ * memcpy's are just how C lets us load and store unaligned words)
+ */
+void unmask_prf_output( unsigned char *result,
+	                const unsigned char *prf_output )
+{
+    for (int j=0; j<SPX_N; j+=8) {
+	uint64_t a, b, c;
+	memcpy( &a, &prf_output[j], 8 );
+	memcpy( &b, &prf_output[j + SPX_N], 8 );
+	memcpy( &c, &prf_output[j + 2*SPX_N], 8 );
+	a ^= b ^ c;
+	memcpy( &result[j], &a, 8 );
+    }
+}
+
 /*
  * This sets up the threshold chain state
  * This returns the offset of the running hash within the chain state
@@ -101,6 +140,28 @@ unsigned set_up_f_block( uint64_t *chain_state,
     return OFFSET_HASH;
 }
 
+/*
+ * Replace the (threshold) input value in a chain state that has already
+ * been set up by set_up_f_block.  Together with update_f_block_tree_addr,
+ * this lets us reuse one chain state for all the leaves of a FORS tree,
+ * rather than setting up a fresh one for every leaf
+ */
+void set_f_block_value( uint64_t *chain_state,
+	                const unsigned char *prf_output )
+{
+    transform_f( &chain_state[OFFSET_HASH],      &prf_output[0*SPX_N], SPX_N );
+    transform_f( &chain_state[OFFSET_HASH + 25], &prf_output[1*SPX_N], SPX_N );
+    transform_f( &chain_state[OFFSET_HASH + 50], &prf_output[2*SPX_N], SPX_N );
+}
+
+/*
+ * Reload the ADRS lane that holds the tree height/index from addr
+ */
+void update_f_block_tree_addr( uint64_t *chain_state, const uint32_t addr[8] )
+{
+    transform_f( &chain_state[N + 3], (const unsigned char *)addr + 24, 8 );
+}
+
 /*
  * This reaches into the hash address field of the ADRS structure within the
  * chain state, and increments it (setting things up for the next F evaluation)
@@ -139,3 +200,60 @@ void f_transform( uint64_t *chain_state, int keep_blinded )
     }
 }
 
+
+/*
+ * This performs the F function on up to four chain states at once (a null
+ * chain_state[i] marks an unused lane), each as f_transform would
+ * The lanes needn't agree on keep_blinded; if any of them wants a blinded
+ * result, we run the threshold version of the permutation for all of them,
+ * and unblind the others afterwards (which gives the same value)
+ * Without AVX2, the x4 permutation is just four scalar ones; so there we
+ * run only the lanes in use, each with its own keep_blinded
+ */
+void f_transformx4( uint64_t *chain_state[4], const int keep_blinded[4] )
+{
+#if defined(__AVX2__)
+    uint64_t output_state[4][3 * 25];
+    const uint64_t *in[4];
+    uint64_t *out[4];
+    const uint64_t *filler = 0;
+    int any_blinded = 0;
+    int i, j;
+
+    for (i=0; i<4; i++) {
+	if (chain_state[i]) filler = chain_state[i];
+    }
+    for (i=0; i<4; i++) {
+	/* Unused lanes just recompute one of the others */
+	in[i] = chain_state[i] ? chain_state[i] : filler;
+	out[i] = output_state[i];
+	if (chain_state[i] && keep_blinded[i]) any_blinded = 1;
+    }
+
+    do_threshold_keccak_permutationx4( in, out, any_blinded );
+
+    for (i=0; i<4; i++) {
+	if (!chain_state[i]) continue;
+	if (keep_blinded[i]) {
+            memcpy( &chain_state[i][OFFSET_HASH], &output_state[i][0], SPX_N );
+            memcpy( &chain_state[i][OFFSET_HASH + 25], &output_state[i][25],
+		    SPX_N );
+            memcpy( &chain_state[i][OFFSET_HASH + 50], &output_state[i][50],
+		    SPX_N );
+	} else if (any_blinded) {
+	    for (j=0; j<N; j++) {
+		chain_state[i][OFFSET_HASH + j] = output_state[i][j] ^
+			  output_state[i][j + 25] ^ output_state[i][j + 50];
+	    }
+	} else {
+            memcpy( &chain_state[i][OFFSET_HASH], &output_state[i][0], SPX_N );
+	}
+    }
+#else
+    int i;
+
+    for (i=0; i<4; i++) {
+	if (chain_state[i]) f_transform( chain_state[i], keep_blinded[i] );
+    }
+#endif
+}
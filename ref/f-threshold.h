@@ -11,12 +11,43 @@ unsigned set_up_f_block( uint64_t *chain_state,
 	                 const unsigned char *prf_output,
                          const spx_ctx *ctx, uint32_t addr[8] );
 
+/*
+ * Convert a byte string (num_bytes, a multiple of 8) into the uint64_t
+ * (Keccak lane) encoding
+ */
+void transform_f( uint64_t *output, const void *input, int num_bytes );
+
 /*
  * Convert the uint64_t encoded value into a byte string representation
  * This converts SPX_N bytes
  */
 void untransform_f( unsigned char *result, const uint64_t *encoded );
 
+/*
+ * Unblind count values, each held as 3 shares of SPX_N/8 words, and write
+ * them out as consecutive SPX_N byte strings
+ */
+void unmask_f_values( unsigned char *result, const uint64_t *shares,
+	              unsigned count );
+
+/*
+ * Unblind a PRF output (3 shares of SPX_N bytes) into the SPX_N byte value
+ */
+void unmask_prf_output( unsigned char *result,
+	                const unsigned char *prf_output );
+
+/*
+ * Replace the (threshold) input value in a chain state set up by
+ * set_up_f_block
+ */
+void set_f_block_value( uint64_t *chain_state,
+	                const unsigned char *prf_output );
+
+/*
+ * Reload the ADRS lane that holds the tree height/index from addr
+ */
+void update_f_block_tree_addr( uint64_t *chain_state, const uint32_t addr[8] );
+
 /*
  * Increment the running hash address in the chain state to k
  */
@@ -29,4 +60,10 @@ void increment_hash_addr_in_chain_state( uint64_t *chain_state );
  */
 void f_transform( uint64_t *chain_state, int keep_blinded );
 
+/*
+ * Perform the f operation on up to four chain states (a null entry is an
+ * unused lane), each with its own keep_blinded
+ */
+void f_transformx4( uint64_t *chain_state[4], const int keep_blinded[4] );
+
 #endif
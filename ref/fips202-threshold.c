@@ -607,3 +607,157 @@ void do_threshold_keccak_permutation( const uint64_t *instate,
 	}
     }
 }
+
+/*************************************************
+ * Name:        do_threshold_keccak_permutationx4
+ *
+ * Description: Four independent threshold Keccak permutations; this
+ *              computes exactly what four calls to
+ *              do_threshold_keccak_permutation would (same round schedule,
+ *              same share arithmetic), and just like it, outputs only
+ *              the first 4 words of each share.
+ *              If we're built for AVX2, the four states are run side by
+ *              side, one per 64 bit lane of a 256 bit vector; if not, this
+ *              just calls the single version four times
+ *
+ * Arguments:   - const uint64_t *instate[4]: the 4 input states (each 75
+ *                    words in threshold format)
+ *                uint64_t *outstate[4]: the 4 output states
+ *                int output_threshold - as do_threshold_keccak_permutation
+ **************************************************/
+#if defined(__AVX2__)
+
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+#define ROLV(a, offset) \
+    ((offset) ? (((a) << (offset)) ^ ((a) >> (64 - (offset)))) : (a))
+
+/* The rho rotation of lane x+5y */
+static const int rho_offsets[25] = {
+     0,  1, 62, 28, 27,
+    36, 44,  6, 55, 20,
+     3, 10, 43, 25, 39,
+    41, 45, 15, 21,  8,
+    18,  2, 61, 56, 14
+};
+
+/*
+ * The linear part of a round (theta, rho and pi) on one share; the result
+ * is left in B, ready for chi
+ */
+static void theta_rho_pi_x4(v4u64 *B, const v4u64 *A)
+{
+    v4u64 C[5], D;
+    int x, y;
+
+    for (x = 0; x < 5; x++) {
+	C[x] = A[x] ^ A[x+5] ^ A[x+10] ^ A[x+15] ^ A[x+20];
+    }
+    for (x = 0; x < 5; x++) {
+	D = C[(x+4)%5] ^ ROLV(C[(x+1)%5], 1);
+	for (y = 0; y < 5; y++) {
+	    /* Lane (x, y) moves to (y, 2x+3y) */
+	    B[y + 5*((2*x + 3*y) % 5)] = ROLV(A[x + 5*y] ^ D,
+					      rho_offsets[x + 5*y]);
+	}
+    }
+}
+
+/* A Keccak round on the unthresholded state in share 0 */
+static void keccak_round_1_x4(v4u64 A[3][25], int round)
+{
+    v4u64 B[25];
+    int x, y;
+
+    theta_rho_pi_x4(B, A[0]);
+    for (y = 0; y < 25; y += 5) {
+	for (x = 0; x < 5; x++) {
+	    A[0][y+x] = B[y+x] ^ (~B[y+(x+1)%5] & B[y+(x+2)%5]);
+	}
+    }
+    A[0][0] ^= KeccakF_RoundConstants[round];
+}
+
+/* A Keccak round on the thresholded state; chi is as in Keccak_3 above */
+static void keccak_round_3_x4(v4u64 A[3][25], int round)
+{
+    v4u64 B[3][25];
+    int s, x, y;
+
+    for (s = 0; s < 3; s++) {
+	theta_rho_pi_x4(B[s], A[s]);
+    }
+    for (y = 0; y < 25; y += 5) {
+	for (x = 0; x < 5; x++) {
+	    int i1 = y + (x+1)%5, i2 = y + (x+2)%5;
+	    for (s = 0; s < 3; s++) {
+		A[s][y+x] = B[s][y+x] ^ (~B[0][i1] & B[s][i2])
+				      ^ (~B[1][i1] & B[(s+1)%3][i2])
+				      ^ (~B[2][i1] & B[(s+2)%3][i2]);
+	    }
+	}
+    }
+    A[0][0] ^= KeccakF_RoundConstants[round];
+}
+
+static void do_xor_x4(v4u64 A[3][25])
+{
+    for (int i = 0; i < 25; i++) {
+	A[0][i] ^= A[1][i] ^ A[2][i];
+    }
+}
+
+void do_threshold_keccak_permutationx4( const uint64_t *instate[4],
+					uint64_t *outstate[4],
+					int output_threshold )
+{
+    v4u64 A[3][25];
+    int round = 0;
+    int i, s, lane;
+    int single_rounds = NROUNDS - BLINDED_ROUNDS -
+			(output_threshold ? BLINDED_ROUNDS : 0);
+
+    for (s = 0; s < 3; s++) {
+	for (i = 0; i < 25; i++) {
+	    A[s][i] = (v4u64){ instate[0][i+25*s], instate[1][i+25*s],
+			       instate[2][i+25*s], instate[3][i+25*s] };
+	}
+    }
+
+    for (i = 0; i < BLINDED_ROUNDS; i++) {
+	keccak_round_3_x4(A, round++);
+    }
+    do_xor_x4(A);
+    for (i = 0; i < single_rounds; i++) {
+	keccak_round_1_x4(A, round++);
+    }
+    if (output_threshold) {
+	do_xor_x4(A);
+	for (i = 0; i < BLINDED_ROUNDS; i++) {
+	    keccak_round_3_x4(A, round++);
+	}
+    }
+
+    /* As above, we output only the first 4 words of each share */
+    for (s = 0; s < (output_threshold ? 3 : 1); s++) {
+	for (i = 0; i < 4; i++) {
+	    for (lane = 0; lane < 4; lane++) {
+		outstate[lane][i+25*s] = A[s][i][lane];
+	    }
+	}
+    }
+}
+
+#else
+
+void do_threshold_keccak_permutationx4( const uint64_t *instate[4],
+					uint64_t *outstate[4],
+					int output_threshold )
+{
+    for (int lane = 0; lane < 4; lane++) {
+	do_threshold_keccak_permutation( instate[lane], outstate[lane],
+					 output_threshold );
+    }
+}
+
+#endif
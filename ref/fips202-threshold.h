@@ -8,3 +8,12 @@
 void do_threshold_keccak_permutation( const uint64_t *instate,
 	                                    uint64_t *outstate1,
 				            int output_threshold );
+
+/*
+ * This computes four independent threshold Keccak permutations (as four
+ * calls to do_threshold_keccak_permutation would), side by side if we're
+ * built for AVX2
+ */
+void do_threshold_keccak_permutationx4( const uint64_t *instate[4],
+					uint64_t *outstate[4],
+					int output_threshold );
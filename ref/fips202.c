@@ -10,6 +10,10 @@
 
 #include "fips202.h"
 
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 #define NROUNDS 24
 #define ROL(a, offset) (((a) << (offset)) ^ ((a) >> (64 - (offset))))
 
@@ -61,14 +65,131 @@ static const uint64_t KeccakF_RoundConstants[NROUNDS] = {
     0x0000000080000001ULL, 0x8000000080008008ULL
 };
 
+#if defined(__AVX512F__)
 /*************************************************
- * Name:        KeccakF1600_StatePermute
+ * Name:        KeccakP1600_StatePermute
  *
- * Description: The Keccak F1600 Permutation
+ * Description: The Keccak-p[1600] permutation, running the rounds
+ *              first_round..NROUNDS-1 (so first_round = 0 is Keccak-f)
+ *
+ *              This version keeps each plane (the 5 lanes with the same
+ *              y) in a zmm register, so theta, rho and chi work on a
+ *              whole plane at a time, and pi is a gather of one lane from
+ *              each plane.  Lanes 5-7 of each register are unused.  This
+ *              is for the latency of a single hash; there is no multi-state
+ *              version
  *
  * Arguments:   - uint64_t *state: pointer to input/output Keccak state
+ *              - int first_round: the first round to run
  **************************************************/
-static void KeccakF1600_StatePermute(uint64_t *state) {
+static void KeccakP1600_StatePermute(uint64_t *state, int first_round) {
+    const __mmask8 plane = 0x1f;
+    int round;
+
+    /* Lane x of the result comes from lane x-1 (or x+1, x+2) */
+    const __m512i prev = _mm512_setr_epi64(4, 0, 1, 2, 3, 5, 6, 7);
+    const __m512i next = _mm512_setr_epi64(1, 2, 3, 4, 0, 5, 6, 7);
+    const __m512i next2 = _mm512_setr_epi64(2, 3, 4, 0, 1, 5, 6, 7);
+
+    /* The rho rotations of each plane */
+    const __m512i rho0 = _mm512_setr_epi64( 0,  1, 62, 28, 27, 0, 0, 0);
+    const __m512i rho1 = _mm512_setr_epi64(36, 44,  6, 55, 20, 0, 0, 0);
+    const __m512i rho2 = _mm512_setr_epi64( 3, 10, 43, 25, 39, 0, 0, 0);
+    const __m512i rho3 = _mm512_setr_epi64(41, 45, 15, 21,  8, 0, 0, 0);
+    const __m512i rho4 = _mm512_setr_epi64(18,  2, 61, 56, 14, 0, 0, 0);
+
+    /*
+     * pi moves lane (x, y) to (y, 2x+3y); hence lane X of plane Y comes
+     * from lane (X+3Y) mod 5 of plane X.  We gather planes 0 and 1 with
+     * one permutex2var, planes 2 and 3 with another (merging in plane 4
+     * with a masked permutexvar), and then blend the two together
+     */
+#define PI_INDEX(Y) \
+    _mm512_setr_epi64((3*(Y)) % 5, 8 + (3*(Y)+1) % 5, \
+                      (3*(Y)+2) % 5, 8 + (3*(Y)+3) % 5, \
+                      (3*(Y)+4) % 5, 5, 6, 7)
+    const __m512i pi0 = PI_INDEX(0);
+    const __m512i pi1 = PI_INDEX(1);
+    const __m512i pi2 = PI_INDEX(2);
+    const __m512i pi3 = PI_INDEX(3);
+    const __m512i pi4 = PI_INDEX(4);
+#undef PI_INDEX
+
+    __m512i a0, a1, a2, a3, a4;
+    __m512i b0, b1, b2, b3, b4;
+    __m512i c, d_prev, d_next;
+
+    a0 = _mm512_maskz_loadu_epi64(plane, state);
+    a1 = _mm512_maskz_loadu_epi64(plane, state + 5);
+    a2 = _mm512_maskz_loadu_epi64(plane, state + 10);
+    a3 = _mm512_maskz_loadu_epi64(plane, state + 15);
+    a4 = _mm512_maskz_loadu_epi64(plane, state + 20);
+
+    for (round = first_round; round < NROUNDS; round++) {
+        /* theta: 0x96 is a three way xor */
+        c = _mm512_ternarylogic_epi64(a0, a1, a2, 0x96);
+        c = _mm512_ternarylogic_epi64(c, a3, a4, 0x96);
+        d_prev = _mm512_permutexvar_epi64(prev, c);
+        d_next = _mm512_rol_epi64(_mm512_permutexvar_epi64(next, c), 1);
+        a0 = _mm512_ternarylogic_epi64(a0, d_prev, d_next, 0x96);
+        a1 = _mm512_ternarylogic_epi64(a1, d_prev, d_next, 0x96);
+        a2 = _mm512_ternarylogic_epi64(a2, d_prev, d_next, 0x96);
+        a3 = _mm512_ternarylogic_epi64(a3, d_prev, d_next, 0x96);
+        a4 = _mm512_ternarylogic_epi64(a4, d_prev, d_next, 0x96);
+
+        /* rho */
+        a0 = _mm512_rolv_epi64(a0, rho0);
+        a1 = _mm512_rolv_epi64(a1, rho1);
+        a2 = _mm512_rolv_epi64(a2, rho2);
+        a3 = _mm512_rolv_epi64(a3, rho3);
+        a4 = _mm512_rolv_epi64(a4, rho4);
+
+        /* pi */
+#define PI_GATHER(idx) \
+    _mm512_mask_blend_epi64(0x03, \
+        _mm512_mask_permutexvar_epi64( \
+            _mm512_permutex2var_epi64(a2, idx, a3), 0x10, idx, a4), \
+        _mm512_permutex2var_epi64(a0, idx, a1))
+        b0 = PI_GATHER(pi0);
+        b1 = PI_GATHER(pi1);
+        b2 = PI_GATHER(pi2);
+        b3 = PI_GATHER(pi3);
+        b4 = PI_GATHER(pi4);
+#undef PI_GATHER
+
+        /* chi: 0xd2 is a ^ (~b & c) */
+#define CHI(b) \
+    _mm512_ternarylogic_epi64(b, _mm512_permutexvar_epi64(next, b), \
+                              _mm512_permutexvar_epi64(next2, b), 0xd2)
+        a0 = CHI(b0);
+        a1 = CHI(b1);
+        a2 = CHI(b2);
+        a3 = CHI(b3);
+        a4 = CHI(b4);
+#undef CHI
+
+        /* iota */
+        a0 = _mm512_mask_xor_epi64(a0, 0x01, a0, _mm512_set1_epi64(
+                             (long long)KeccakF_RoundConstants[round]));
+    }
+
+    _mm512_mask_storeu_epi64(state, plane, a0);
+    _mm512_mask_storeu_epi64(state + 5, plane, a1);
+    _mm512_mask_storeu_epi64(state + 10, plane, a2);
+    _mm512_mask_storeu_epi64(state + 15, plane, a3);
+    _mm512_mask_storeu_epi64(state + 20, plane, a4);
+}
+#else
+/*************************************************
+ * Name:        KeccakP1600_StatePermute
+ *
+ * Description: The Keccak-p[1600] permutation, running the rounds
+ *              first_round..NROUNDS-1 (so first_round = 0 is Keccak-f)
+ *
+ * Arguments:   - uint64_t *state: pointer to input/output Keccak state
+ *              - int first_round: the first round to run; must be even
+ **************************************************/
+static void KeccakP1600_StatePermute(uint64_t *state, int first_round) {
     int round;
 
     uint64_t Aba, Abe, Abi, Abo, Abu;
@@ -111,7 +232,7 @@ static void KeccakF1600_StatePermute(uint64_t *state) {
     Aso = state[23];
     Asu = state[24];
 
-    for (round = 0; round < NROUNDS; round += 2) {
+    for (round = first_round; round < NROUNDS; round += 2) {
         //    prepareTheta
         BCa = Aba ^ Aga ^ Aka ^ Ama ^ Asa;
         BCe = Abe ^ Age ^ Ake ^ Ame ^ Ase;
@@ -330,6 +451,30 @@ static void KeccakF1600_StatePermute(uint64_t *state) {
     state[23] = Aso;
     state[24] = Asu;
 }
+#endif
+
+/*************************************************
+ * Name:        KeccakF1600_StatePermute
+ *
+ * Description: The Keccak F1600 Permutation
+ *
+ * Arguments:   - uint64_t *state: pointer to input/output Keccak state
+ **************************************************/
+void KeccakF1600_StatePermute(uint64_t *state) {
+    KeccakP1600_StatePermute(state, 0);
+}
+
+/*************************************************
+ * Name:        KeccakP1600_12_StatePermute
+ *
+ * Description: The 12 round Keccak-p[1600] permutation used by TurboSHAKE
+ *              (the last 12 rounds of Keccak-f)
+ *
+ * Arguments:   - uint64_t *state: pointer to input/output Keccak state
+ **************************************************/
+void KeccakP1600_12_StatePermute(uint64_t *state) {
+    KeccakP1600_StatePermute(state, NROUNDS - 12);
+}
 
 /*************************************************
  * Name:        keccak_absorb
@@ -632,3 +777,56 @@ void shake128(uint8_t *output, size_t outlen,
         }
     }
 }
+
+/*************************************************
+ * Name:        turboshake128
+ *
+ * Description: TurboSHAKE128 XOF (SHAKE128 with the 12 round Keccak-p
+ *              permutation, and a caller chosen domain separation byte)
+ *
+ * Arguments:   - uint8_t *output: pointer to output
+ *              - size_t outlen: requested output length in bytes
+ *              - const uint8_t *input: pointer to input
+ *              - size_t inlen: length of input in bytes
+ *              - uint8_t domain: domain separation byte (0x01 to 0x7f)
+ **************************************************/
+void turboshake128(uint8_t *output, size_t outlen,
+                   const uint8_t *input, size_t inlen, uint8_t domain) {
+    size_t i;
+    uint8_t t[SHAKE128_RATE];
+    uint64_t s[25] = {0};
+
+    while (inlen >= SHAKE128_RATE) {
+        for (i = 0; i < SHAKE128_RATE / 8; ++i) {
+            s[i] ^= load64(input + 8 * i);
+        }
+        KeccakP1600_12_StatePermute(s);
+        inlen -= SHAKE128_RATE;
+        input += SHAKE128_RATE;
+    }
+
+    for (i = 0; i < SHAKE128_RATE; ++i) {
+        t[i] = 0;
+    }
+    for (i = 0; i < inlen; ++i) {
+        t[i] = input[i];
+    }
+    t[i] = domain;
+    t[SHAKE128_RATE - 1] |= 128;
+    for (i = 0; i < SHAKE128_RATE / 8; ++i) {
+        s[i] ^= load64(t + 8 * i);
+    }
+
+    while (outlen > 0) {
+        size_t len = outlen < SHAKE128_RATE ? outlen : SHAKE128_RATE;
+        KeccakP1600_12_StatePermute(s);
+        for (i = 0; i < SHAKE128_RATE / 8; ++i) {
+            store64(t + 8 * i, s[i]);
+        }
+        for (i = 0; i < len; ++i) {
+            output[i] = t[i];
+        }
+        output += len;
+        outlen -= len;
+    }
+}
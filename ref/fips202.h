@@ -9,6 +9,9 @@
 #define SHA3_256_RATE 136
 #define SHA3_512_RATE 72
 
+void KeccakF1600_StatePermute(uint64_t *state);
+void KeccakP1600_12_StatePermute(uint64_t *state);
+
 void shake128_absorb(uint64_t *s, const uint8_t *input, size_t inlen);
 
 void shake128_squeezeblocks(uint8_t *output, size_t nblocks, uint64_t *s);
@@ -32,6 +35,9 @@ void shake128(uint8_t *output, size_t outlen,
 void shake256(uint8_t *output, size_t outlen,
               const uint8_t *input, size_t inlen);
 
+void turboshake128(uint8_t *output, size_t outlen,
+                   const uint8_t *input, size_t inlen, uint8_t domain);
+
 void sha3_256_inc_init(uint64_t *s_inc);
 void sha3_256_inc_absorb(uint64_t *s_inc, const uint8_t *input, size_t inlen);
 void sha3_256_inc_finalize(uint8_t *output, uint64_t *s_inc);
@@ -10,6 +10,7 @@
 #include "address.h"
 #include "prf.h"
 #include "f-threshold.h"
+#include "f-coalesce.h"
 
 static void fors_sk_to_leaf(unsigned char *leaf, const unsigned char *sk,
                             const spx_ctx *ctx,
@@ -18,37 +19,150 @@ static void fors_sk_to_leaf(unsigned char *leaf, const unsigned char *sk,
     thash(leaf, sk, 1, ctx, fors_leaf_addr);
 }
 
+#if defined(SPX_F_COALESCE)
+/*
+ * How many leaves we compute in one coalesced batch; a whole tree, if it's
+ * small (the jobs for a large one wouldn't fit on the stack)
+ */
+#define FORS_BATCH ((1 << SPX_FORS_HEIGHT) < 64 ? (1 << SPX_FORS_HEIGHT) : 64)
+#endif
+
 struct fors_gen_leaf_info {
     uint32_t leaf_addrx[8];
     struct prf_iter *iter;  /* The iterator that will give us the next */
                             /* PRF value */
+    /* The F chain state, set up once; only the tree index and the input */
+    /* shares differ between one FORS leaf and the next */
+    uint64_t chain_state[3*25];
+    unsigned hash_offset;   /* Where the F output lands in chain_state */
+#if defined(SPX_FAULT_CHECK)
+    uint32_t check_idx;     /* The leaf whose secret we've revealed */
+    const unsigned char *check_value; /* Its shares, as we derived them */
+    const unsigned char *check_revealed; /* What we wrote into the */
+                                         /* signature for it */
+    int fault;              /* Set if the iterator disagreed */
+#endif
+#if defined(SPX_F_COALESCE)
+    /* The leaves of the batch we last computed */
+    uint32_t first_leaf;
+    uint32_t leaf_count;
+    unsigned char leaves[FORS_BATCH][SPX_N];
+#endif
 };
 
+/*
+ * Get the PRF output for the leaf addr_idx (which must be the next one the
+ * iterator gives)
+ */
+static void fors_leaf_prf(unsigned char *temp_buffer,
+                          struct fors_gen_leaf_info *fors_info,
+                          uint32_t addr_idx)
+{
+    next_prf_iter( temp_buffer, fors_info->iter );
+
+#if defined(SPX_FAULT_CHECK)
+    /* The iterator rederives the secret we revealed in the signature (via */
+    /* a different path through the PRF tree); check that they agree */
+    /* We also unmask the iterator's value here (byte by byte, rather */
+    /* than with unmask_prf_output) and check it against what actually */
+    /* went into the signature, so a fault while unmasking is caught too */
+    if (addr_idx == fors_info->check_idx) {
+        unsigned char diff = 0;
+        for (int j=0; j<3*SPX_N; j++) {
+            diff |= temp_buffer[j] ^ fors_info->check_value[j];
+        }
+        for (int j=0; j<SPX_N; j++) {
+            diff |= temp_buffer[j] ^ temp_buffer[j + SPX_N] ^
+                    temp_buffer[j + 2*SPX_N] ^ fors_info->check_revealed[j];
+        }
+        fors_info->fault |= (diff != 0);
+    }
+#else
+    (void)addr_idx;
+#endif
+}
+
+#if defined(SPX_F_COALESCE)
+/*
+ * Compute the FORS_BATCH leaves starting at addr_idx, all as one batch of
+ * (one step) chains, which we run four lanes at a time (sharing lanes with
+ * other threads' chains)
+ */
+static void fors_gen_batch(struct fors_gen_leaf_info *fors_info,
+                           uint32_t addr_idx)
+{
+    uint32_t *fors_leaf_addr = fors_info->leaf_addrx;
+    struct f_job jobs[FORS_BATCH];
+    unsigned char temp_buffer[3*SPX_N];
+    unsigned i;
+
+    for (i = 0; i < FORS_BATCH; i++) {
+        uint64_t *state = jobs[i].chain_state;
+
+        set_tree_index(fors_leaf_addr, addr_idx + i);
+        fors_leaf_prf( temp_buffer, fors_info, addr_idx + i );
+
+        memcpy( state, fors_info->chain_state, sizeof jobs[i].chain_state );
+        update_f_block_tree_addr( state, fors_leaf_addr );
+        set_f_block_value( state, temp_buffer );
+        jobs[i].value_offset = fors_info->hash_offset;
+        jobs[i].steps = 1;
+        jobs[i].capture = ~0u;
+        jobs[i].captured = 0;
+    }
+    memset( temp_buffer, 0, sizeof temp_buffer );
+
+    coalesce_f_chains( jobs, FORS_BATCH );
+
+    for (i = 0; i < FORS_BATCH; i++) {
+        untransform_f( fors_info->leaves[i],
+                       &jobs[i].chain_state[jobs[i].value_offset] );
+    }
+    memset( jobs, 0, sizeof jobs );
+    fors_info->first_leaf = addr_idx;
+    fors_info->leaf_count = FORS_BATCH;
+}
+#endif
+
 static void fors_gen_leafx1(unsigned char *leaf,
                             const spx_ctx *ctx,
                             uint32_t addr_idx, void *info)
 {
     struct fors_gen_leaf_info *fors_info = info;
+#if defined(SPX_F_COALESCE)
+    (void)ctx;
+
+    /* treehashx1 asks for the leaves in order, and each tree has a whole */
+    /* number of batches; so when we run out, the next batch starts here */
+    if (addr_idx - fors_info->first_leaf >= fors_info->leaf_count) {
+        fors_gen_batch( fors_info, addr_idx );
+    }
+    memcpy( leaf, fors_info->leaves[addr_idx - fors_info->first_leaf],
+            SPX_N );
+#else
     uint32_t *fors_leaf_addr = fors_info->leaf_addrx;
+    uint64_t *state = fors_info->chain_state;
     unsigned char temp_buffer[3*SPX_N];
-    uint64_t state[3*25];
+
+    (void)ctx;
 
     /* Only set the parts that the caller doesn't set */
     set_tree_index(fors_leaf_addr, addr_idx);
 
     /* Get the PRF output */
-    next_prf_iter( temp_buffer, fors_info->iter );
+    fors_leaf_prf( temp_buffer, fors_info, addr_idx );
 
     /* Perform the F function.  We use our fancy threshold */
     /* implementation; the input is blinded, the output is not (because */
     /* it's safe if the attacker learns the F output here) */
-    set_type(fors_leaf_addr, SPX_ADDR_TYPE_FORSTREE);
-    unsigned k = set_up_f_block( state, temp_buffer, ctx, fors_leaf_addr );
+    update_f_block_tree_addr( state, fors_leaf_addr );
+    set_f_block_value( state, temp_buffer );
 
     f_transform( state, 0 );  /* 0 -> unblind the result */
 
     /* And copy out the result */
-    untransform_f( leaf, &state[k] );
+    untransform_f( leaf, &state[fors_info->hash_offset] );
+#endif
 }
 
 /**
@@ -56,7 +170,7 @@ static void fors_gen_leafx1(unsigned char *leaf,
  * Assumes m contains at least SPX_FORS_HEIGHT * SPX_FORS_TREES bits.
  * Assumes indices has space for SPX_FORS_TREES integers.
  */
-static void message_to_indices(uint32_t *indices, const unsigned char *m)
+void message_to_indices(uint32_t *indices, const unsigned char *m)
 {
     unsigned int i, j;
     unsigned int offset = 0;
@@ -73,8 +187,10 @@ static void message_to_indices(uint32_t *indices, const unsigned char *m)
 /**
  * Signs a message m, deriving the secret key from sk_seed and the FTS address.
  * Assumes m contains at least SPX_FORS_HEIGHT * SPX_FORS_TREES bits.
+ * Returns 0 on success, -1 if a fault was detected, SPX_CANCELLED if the
+ * cancellation token in ctx was set
  */
-void fors_sign(unsigned char *sig, unsigned char *pk,
+int fors_sign(unsigned char *sig, unsigned char *pk,
                const unsigned char *m,
                const spx_ctx *ctx,
                const uint32_t fors_addr[8])
@@ -92,6 +208,17 @@ void fors_sign(unsigned char *sig, unsigned char *pk,
 
     copy_keypair_addr(fors_tree_addr, fors_addr);
     copy_keypair_addr(fors_leaf_addr, fors_addr);
+    set_type(fors_leaf_addr, SPX_ADDR_TYPE_FORSTREE);
+
+    /*
+     * Set up the F chain state for the leaves once; everything other than
+     * the tree index and the input is the same for every leaf of every tree
+     */
+    {
+        unsigned char zero[3*SPX_N] = {0};
+        fors_info.hash_offset = set_up_f_block( fors_info.chain_state, zero,
+                                                ctx, fors_leaf_addr );
+    }
 
     copy_keypair_addr(fors_pk_addr, fors_addr);
     set_type(fors_pk_addr, SPX_ADDR_TYPE_FORSPK);
@@ -108,12 +235,18 @@ void fors_sign(unsigned char *sig, unsigned char *pk,
 		          (int)count_fors_leaves,
 		          (int)count_fors_leaves,
                           ctx->fors_seed, ctx, top_prf_addr );
+    /* Expand the PRF tree in another thread, if we're built for that */
+    (void)start_prf_pipeline( &prf_iter );
 
     message_to_indices(indices, m);
 
     for (i = 0; i < SPX_FORS_TREES; i++) {
 	unsigned char temp_buffer[3*SPX_N];
 
+        if (spx_cancelled(ctx)) {
+            goto cancelled;
+        }
+
         idx_offset = i * (1 << SPX_FORS_HEIGHT);
 
         set_tree_height(fors_tree_addr, 0);
@@ -127,27 +260,49 @@ void fors_sign(unsigned char *sig, unsigned char *pk,
 	/* eval_single_prf_leaf gives us the value in threshold format */
         /* Convert it into the format that the verifier will expect to see */
 	/* in the signature */
-	for (int j=0; j<SPX_N; j++) {
-	    sig[j] = temp_buffer[j] ^ temp_buffer[j + SPX_N] ^ temp_buffer[j + 2*SPX_N];
-	}
+	unmask_prf_output( sig, temp_buffer );
         sig += SPX_N;
 
 	/* And pass the iterator that will produce all the PRF values */
         fors_info.iter = &prf_iter;
+#if defined(SPX_FAULT_CHECK)
+        fors_info.check_idx = indices[i] + idx_offset;
+        fors_info.check_value = temp_buffer;
+        fors_info.check_revealed = sig - SPX_N;
+#endif
 
         set_type(fors_tree_addr, SPX_ADDR_TYPE_FORSTREE);
         set_tree_index(fors_tree_addr, indices[i] + idx_offset);
 
         /* Compute the authentication path for this leaf node. */
-        treehashx1(roots + i*SPX_N, sig, ctx,
+        if (treehashx1(roots + i*SPX_N, sig, ctx,
                  indices[i], idx_offset, SPX_FORS_HEIGHT, fors_gen_leafx1,
-                 fors_tree_addr, &fors_info);
+                 fors_tree_addr, &fors_info)) {
+            memset(temp_buffer, 0, sizeof temp_buffer);
+            goto cancelled;
+        }
 
         sig += SPX_N * SPX_FORS_HEIGHT;
     }
 
+    stop_prf_pipeline( &prf_iter );
+
     /* Hash horizontally across all tree roots to derive the public key. */
     thash(pk, roots, SPX_FORS_TREES, ctx, fors_pk_addr);
+
+#if defined(SPX_FAULT_CHECK)
+    if (fors_info.fault) return -1;
+#endif
+    return 0;
+
+cancelled:
+    stop_prf_pipeline( &prf_iter );
+
+    /* Wipe the iterator and the F chain state, which hold shares of the */
+    /* FORS secrets */
+    memset(&prf_iter, 0, sizeof prf_iter);
+    memset(&fors_info, 0, sizeof fors_info);
+    return SPX_CANCELLED;
 }
 
 /**
@@ -9,9 +9,11 @@
 /**
  * Signs a message m, deriving the secret key from sk_seed and the FTS address.
  * Assumes m contains at least SPX_FORS_HEIGHT * SPX_FORS_TREES bits.
+ * Returns 0 on success, -1 if a fault was detected, SPX_CANCELLED if the
+ * cancellation token in ctx was set
  */
 #define fors_sign SPX_NAMESPACE(fors_sign)
-void fors_sign(unsigned char *sig, unsigned char *pk,
+int fors_sign(unsigned char *sig, unsigned char *pk,
                const unsigned char *m,
                const spx_ctx* ctx,
                const uint32_t fors_addr[8]);
@@ -29,4 +31,12 @@ void fors_pk_from_sig(unsigned char *pk,
                       const spx_ctx* ctx,
                       const uint32_t fors_addr[8]);
 
+/**
+ * Interprets m as SPX_FORS_HEIGHT-bit unsigned integers (the leaf we reveal
+ * in each FORS tree).
+ * Assumes indices has space for SPX_FORS_TREES integers.
+ */
+#define message_to_indices SPX_NAMESPACE(message_to_indices)
+void message_to_indices(uint32_t *indices, const unsigned char *m);
+
 #endif
@@ -32,8 +32,15 @@ void prf_addr(unsigned char *out, const spx_ctx *ctx,
 }
 #endif
 
+#if defined(SPX_PRF_TURBOSHAKE128)
+/* The TurboSHAKE domain separation byte for the PRF tree */
+#define SPX_PRF_DOMAIN 0x1f
+#endif
+
 /*
  * Computes the hash function for the PRF
+ * This is SHAKE128 (key format 1) or TurboSHAKE128 (key format 2); the
+ * verifier never sees these values, so either gives standard signatures
  */
 void prf_hash_function(unsigned char *out, const spx_ctx *ctx,
 		       const uint32_t addr[8], const unsigned char *parent)
@@ -44,7 +51,12 @@ void prf_hash_function(unsigned char *out, const spx_ctx *ctx,
     memcpy(buf + SPX_N, addr, SPX_ADDR_BYTES);
     memcpy(buf + SPX_N + SPX_ADDR_BYTES, parent, 3*SPX_N);
 
+#if defined(SPX_PRF_TURBOSHAKE128)
+    turboshake128(out, 3*SPX_N, buf, 4*SPX_N + SPX_ADDR_BYTES,
+                  SPX_PRF_DOMAIN);
+#else
     shake128(out, 3*SPX_N, buf, 4*SPX_N + SPX_ADDR_BYTES);
+#endif
 }
 
 /**
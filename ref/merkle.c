@@ -6,6 +6,7 @@
 #include "wots.h"
 #include "wotsx1.h"
 #include "merkle.h"
+#include "thash.h"
 #include "address.h"
 #include "params.h"
 
@@ -14,8 +15,10 @@
  * authentication path).  This is in this file because most of the complexity
  * is involved with the WOTS signature; the Merkle authentication path logic
  * is mostly hidden in treehashx4
+ * Returns 0 on success, -1 if a fault was detected in the WOTS signature,
+ * SPX_CANCELLED if the cancellation token in ctx was set
  */
-void merkle_sign(uint8_t *sig, unsigned char *root,
+int merkle_sign(uint8_t *sig, unsigned char *root,
                  const spx_ctx *ctx,
                  uint32_t wots_addr[8], uint32_t tree_addr[8],
                  uint32_t idx_leaf)
@@ -36,6 +39,8 @@ void merkle_sign(uint8_t *sig, unsigned char *root,
 		         (SPX_WOTS_LEN+0) * (1 << SPX_TREE_HEIGHT),
 		          ctx->merkle_key[get_layer_addr(tree_addr)],
 			  ctx, tree_addr );
+    /* Expand the PRF tree in another thread, if we're built for that */
+    (void)start_prf_pipeline( &info.merkle_iter );
 
     set_type(&tree_addr[0], SPX_ADDR_TYPE_HASHTREE);
     set_type(&info.pk_addr[0], SPX_ADDR_TYPE_WOTSPK);
@@ -44,15 +49,26 @@ void merkle_sign(uint8_t *sig, unsigned char *root,
 
     info.wots_sign_leaf = idx_leaf;
 
-    treehashx1(root, auth_path, ctx,
+    int cancelled = treehashx1(root, auth_path, ctx,
                 idx_leaf, 0,
                 SPX_TREE_HEIGHT,
                 wots_gen_leafx1,
                 tree_addr, &info);
+    stop_prf_pipeline( &info.merkle_iter );
+    if (cancelled) {
+        /* Don't leave the PRF state (or the partial WOTS signature) */
+        /* behind */
+        memset(&info, 0, sizeof info);
+        memset(sig, 0, SPX_WOTS_BYTES);
+        return SPX_CANCELLED;
+    }
+
+    return info.fault ? -1 : 0;
 }
 
 /* Compute root node of the top-most subtree. */
-void merkle_gen_root(unsigned char *root, const spx_ctx *ctx)
+/* Returns 0, or SPX_CANCELLED if the cancellation token in ctx was set */
+int merkle_gen_root(unsigned char *root, const spx_ctx *ctx)
 {
     /* We do not need the auth path in key generation, but it simplifies the
        code to have just one treehash routine that computes both root and path
@@ -64,7 +80,123 @@ void merkle_gen_root(unsigned char *root, const spx_ctx *ctx)
     set_layer_addr(top_tree_addr, SPX_D - 1);
     set_layer_addr(wots_addr, SPX_D - 1);
 
-    merkle_sign(auth_path, root, ctx,
+    if (merkle_sign(auth_path, root, ctx,
                 wots_addr, top_tree_addr,
-                (uint32_t)~0 /* ~0 means "don't bother generating an auth path */ );
+                (uint32_t)~0 /* ~0 means "don't bother generating an auth path */ )
+            == SPX_CANCELLED) {
+        return SPX_CANCELLED;
+    }
+    return 0;
+}
+
+/*
+ * Generate all the nodes of the Merkle tree at (layer, tree); this is used
+ * to prepopulate the signer caches.  The nodes are written bottom up, that
+ * is, the 2^h leaves first, then the 2^(h-1) nodes at height 1, and so on,
+ * with the root last
+ * This expects ctx->merkle_key[layer] to be set up for this tree
+ * If leaf_hook is nonzero, it is called before each leaf is generated; if
+ * it returns nonzero, we give up and return -1
+ */
+int merkle_gen_nodes(unsigned char *nodes, const spx_ctx *ctx,
+                     uint32_t layer, uint64_t tree,
+                     int (*leaf_hook)(void *), void *hook_arg)
+{
+    struct leaf_info_x1 info = { 0 };
+    unsigned steps[ SPX_WOTS_LEN ] = { 0 };
+    uint32_t tree_addr[8] = {0};
+    unsigned char *below, *above;
+    uint32_t idx, height;
+
+    set_layer_addr(tree_addr, layer);
+    set_tree_addr(tree_addr, tree);
+
+    info.wots_steps = steps;
+    info.wots_sign_leaf = (uint32_t)~0;  /* No WOTS signature wanted */
+
+    set_type(tree_addr, SPX_ADDR_TYPE_PRF_MERKLE);
+    initialize_prf_iter( &info.merkle_iter,
+		         (SPX_WOTS_LEN+1) * (1 << SPX_TREE_HEIGHT),
+		         (SPX_WOTS_LEN+0) * (1 << SPX_TREE_HEIGHT),
+		          ctx->merkle_key[layer], ctx, tree_addr );
+
+    set_type(tree_addr, SPX_ADDR_TYPE_HASHTREE);
+    set_type(&info.pk_addr[0], SPX_ADDR_TYPE_WOTSPK);
+    copy_subtree_addr(&info.leaf_addr[0], tree_addr);
+    copy_subtree_addr(&info.pk_addr[0], tree_addr);
+
+    /* Generate the leaves */
+    for (idx = 0; idx < (1 << SPX_TREE_HEIGHT); idx++) {
+        if (leaf_hook && leaf_hook(hook_arg)) {
+            /* Don't leave the PRF state behind */
+            memset(&info, 0, sizeof info);
+            return -1;
+        }
+        wots_gen_leafx1(nodes + idx * SPX_N, ctx, idx, &info);
+    }
+    memset(&info, 0, sizeof info);
+
+    /* And hash them up the tree, one level at a time */
+    below = nodes;
+    above = nodes + (1 << SPX_TREE_HEIGHT) * SPX_N;
+    for (height = 1; height <= SPX_TREE_HEIGHT; height++) {
+        uint32_t count = 1U << (SPX_TREE_HEIGHT - height);
+        set_tree_height(tree_addr, height);
+        for (idx = 0; idx < count; idx++) {
+            set_tree_index(tree_addr, idx);
+            thash(above + idx * SPX_N, below + 2 * idx * SPX_N, 2,
+                  ctx, tree_addr);
+        }
+        below = above;
+        above += count * SPX_N;
+    }
+
+    return 0;
+}
+
+/*
+ * Generate just the WOTS signature of msg with leaf idx_leaf of the Merkle
+ * tree at (layer, tree).  This is used when the authentication path is
+ * already known (because we have the tree cached), and so we need not
+ * regenerate the rest of the tree
+ * This expects ctx->merkle_key[layer] to be set up for this tree
+ * Returns 0 on success, -1 if a fault was detected, or SPX_CANCELLED if the
+ * cancellation token in ctx was set (in which case sig is incomplete)
+ */
+int merkle_sign_wots(uint8_t *sig, const unsigned char *msg,
+                     const spx_ctx *ctx,
+                     uint32_t layer, uint64_t tree, uint32_t idx_leaf)
+{
+    struct leaf_info_x1 info = { 0 };
+    unsigned steps[ SPX_WOTS_LEN ];
+    uint32_t tree_addr[8] = {0};
+    unsigned char leaf[SPX_N];
+
+    info.wots_sig = sig;
+    chain_lengths(steps, msg);
+    info.wots_steps = steps;
+
+    set_layer_addr(tree_addr, layer);
+    set_tree_addr(tree_addr, tree);
+
+    /* Start the iterator at the first PRF value of this leaf */
+    set_type(tree_addr, SPX_ADDR_TYPE_PRF_MERKLE);
+    initialize_prf_iter_at( &info.merkle_iter,
+		         (SPX_WOTS_LEN+1) * (1 << SPX_TREE_HEIGHT),
+		         (int)(idx_leaf * SPX_WOTS_LEN),
+		         (int)(idx_leaf * SPX_WOTS_LEN + SPX_WOTS_LEN - 1),
+		          ctx->merkle_key[layer], ctx, tree_addr );
+
+    set_type(&info.pk_addr[0], SPX_ADDR_TYPE_WOTSPK);
+    copy_subtree_addr(&info.leaf_addr[0], tree_addr);
+    copy_subtree_addr(&info.pk_addr[0], tree_addr);
+
+    info.wots_sign_leaf = idx_leaf;
+
+    wots_gen_leafx1(leaf, ctx, idx_leaf, &info);
+    if (spx_cancelled(ctx)) {
+        return SPX_CANCELLED;
+    }
+
+    return info.fault ? -1 : 0;
 }
@@ -5,14 +5,35 @@
 
 /* Generate a Merkle signature (WOTS signature followed by the Merkle */
 /* authentication path) */
+/* Returns 0 on success, -1 if a fault was detected, SPX_CANCELLED if the */
+/* cancellation token in ctx was set */
 #define merkle_sign SPX_NAMESPACE(merkle_sign)
-void merkle_sign(uint8_t *sig, unsigned char *root,
+int merkle_sign(uint8_t *sig, unsigned char *root,
         const spx_ctx* ctx,
         uint32_t wots_addr[8], uint32_t tree_addr[8],
         uint32_t idx_leaf);
 
 /* Compute the root node of the top-most subtree. */
+/* Returns 0, or SPX_CANCELLED if the cancellation token in ctx was set */
 #define merkle_gen_root SPX_NAMESPACE(merkle_gen_root)
-void merkle_gen_root(unsigned char *root, const spx_ctx* ctx);
+int merkle_gen_root(unsigned char *root, const spx_ctx* ctx);
+
+/* The number of nodes in a single Merkle tree (including leaves and root) */
+#define SPX_MERKLE_NODES ((2 << SPX_TREE_HEIGHT) - 1)
+
+/* Generate all the nodes of one Merkle tree, leaves first and root last */
+/* If leaf_hook returns nonzero, this gives up and returns -1 */
+#define merkle_gen_nodes SPX_NAMESPACE(merkle_gen_nodes)
+int merkle_gen_nodes(unsigned char *nodes, const spx_ctx *ctx,
+        uint32_t layer, uint64_t tree,
+        int (*leaf_hook)(void *), void *hook_arg);
+
+/* Generate only the WOTS signature for one leaf of a Merkle tree */
+/* Returns 0 on success, -1 if a fault was detected, or SPX_CANCELLED if */
+/* the cancellation token in ctx was set */
+#define merkle_sign_wots SPX_NAMESPACE(merkle_sign_wots)
+int merkle_sign_wots(uint8_t *sig, const unsigned char *msg,
+        const spx_ctx *ctx,
+        uint32_t layer, uint64_t tree, uint32_t idx_leaf);
 
 #endif /* MERKLE_H_ */
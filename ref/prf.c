@@ -1,6 +1,17 @@
+#if defined(SPX_PRF_PIPELINE)
+#define _GNU_SOURCE     /* For the CPU affinity calls */
+#endif
+#define _POSIX_C_SOURCE 200809L
+
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#if defined(SPX_PRF_PIPELINE)
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "api.h"
 #include "params.h"
@@ -81,17 +92,31 @@ void eval_single_prf_leaf( unsigned char *output, const unsigned char *root,
 void initialize_prf_iter( struct prf_iter *it, int n, int stop_node,
                           const unsigned char *seed, const spx_ctx *ctx,
 			  const uint32_t addr[8] )
+{
+    initialize_prf_iter_at( it, n, 0, stop_node, seed, ctx, addr );
+}
+
+/*
+ * Initialize a prf_iter structure to start at external node start_node
+ * (rather than node 0).  This is used when we need the values for only
+ * one WOTS leaf within a Merkle tree
+ */
+void initialize_prf_iter_at( struct prf_iter *it, int n, int start_node,
+                          int stop_node,
+                          const unsigned char *seed, const spx_ctx *ctx,
+			  const uint32_t addr[8] )
 {
     unsigned min_node;
     it->min_node = min_node = (unsigned)(n+1)/3;
     it->stop_node = stop_node + (int)min_node;
     it->ctx = ctx;
+    it->pipeline = 0;
     memcpy( it->addr, addr, 8 * sizeof(uint32_t) );
 
     /* Compute the path to the first node (in bottom up order) */
     unsigned stack[10];
     int sp = 0;
-    unsigned i = min_node;
+    unsigned i = min_node + (unsigned)start_node;
     while (i > 0) {
 	stack[sp++] = i;
 	i = (i-1)/4;
@@ -112,15 +137,359 @@ void initialize_prf_iter( struct prf_iter *it, int n, int stop_node,
 
     /* Initialize the 'where-we-are' parameters */
     it->num_node = (unsigned)(sp+1);
-    it->cur_node = (int)min_node;
+    it->cur_node = (int)min_node + start_node;
+}
+
+#if defined(SPX_PRF_PIPELINE)
+/*
+ * The PRF pipeline.  The iterator (plain SHAKE) and the F chains (threshold
+ * Keccak) are independent, and stress different parts of the core; so we
+ * can have a second thread (ideally on an SMT sibling) expand the PRF tree
+ * ahead of the thread running the chains.  The two are connected by a
+ * single producer, single consumer ring; each side only ever writes its
+ * own index, and publishes it with a release store, so that the other
+ * side (after an acquire load) sees the slots it covers.
+ *
+ * The thread lives as long as the signing operation, and is handed one
+ * tree after another; between trees (and while it's idle), it sleeps on a
+ * condition variable.  When one side of the ring has to wait for the other
+ * (the ring is full, or empty), it spins for a little while (the other
+ * side is usually just about to catch up), and then sleeps too; it sets
+ * its 'asleep' flag first, so that the other side knows to wake it.
+ */
+#define PRF_RING_SIZE 64    /* A power of 2 */
+#define PRF_RING_SPINS 64   /* How often we yield before we go to sleep */
+
+struct prf_pipeline {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* Signalled when busy or quit is set */
+    pthread_cond_t idle;    /* Signalled when busy is cleared */
+    pthread_cond_t room;    /* Signalled when a slot frees up (or abandon */
+                            /* or quit is set) and the producer is asleep */
+    pthread_cond_t filled;  /* Signalled when a slot is filled and the */
+                            /* consumer is asleep */
+    int busy;               /* The producer has an iterator to run */
+    int quit;               /* The thread is to exit */
+    int producer_asleep;    /* The producer is waiting on room */
+    int consumer_asleep;    /* The consumer is waiting on filled */
+    struct prf_iter iter;   /* The producer's copy of the iterator */
+
+    /* The producer and the consumer each write their own cache line */
+    unsigned head __attribute__((aligned(64)));  /* Next slot to fill */
+    unsigned tail __attribute__((aligned(64)));  /* Next slot to read */
+    int abandon;            /* The consumer doesn't want the rest */
+
+    int index[PRF_RING_SIZE];           /* What next_prf_iter returned */
+    unsigned char value[PRF_RING_SIZE][3*SPX_N];
+};
+
+/*
+ * Whether the producer has to stop (the consumer abandoned the iterator, or
+ * we're told to exit)
+ */
+static int prf_ring_stopped( struct prf_pipeline *p )
+{
+    return __atomic_load_n( &p->abandon, __ATOMIC_RELAXED ) ||
+	   __atomic_load_n( &p->quit, __ATOMIC_RELAXED );
+}
+
+/*
+ * Wake the other side of the ring if it's asleep on cond; this is done
+ * after publishing our index, and the fence pairs with the one in
+ * the sleeper (between setting its flag and rechecking the index), so that
+ * either it sees our index, or we see its flag
+ */
+static void wake_prf_ring( struct prf_pipeline *p, int *asleep,
+			   pthread_cond_t *cond )
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if (__atomic_load_n( asleep, __ATOMIC_RELAXED )) {
+	pthread_mutex_lock( &p->lock );
+	pthread_cond_signal( cond );
+	pthread_mutex_unlock( &p->lock );
+    }
+}
+
+/*
+ * Run the iterator into the ring, until we hit the end, or the consumer
+ * abandons it (or we're told to exit); we check for the last two before
+ * every value, not just when the ring is full
+ */
+static void fill_prf_ring( struct prf_pipeline *p )
+{
+    unsigned head = 0;
+    int spins = 0;
+
+    for (;;) {
+	if (prf_ring_stopped( p )) return;
+
+	/* Wait for room */
+	if (head - __atomic_load_n( &p->tail, __ATOMIC_ACQUIRE ) ==
+						      PRF_RING_SIZE) {
+	    if (spins++ < PRF_RING_SPINS) {
+		sched_yield();
+		continue;
+	    }
+	    pthread_mutex_lock( &p->lock );
+	    __atomic_store_n( &p->producer_asleep, 1, __ATOMIC_RELAXED );
+	    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+	    while (head - __atomic_load_n( &p->tail, __ATOMIC_ACQUIRE ) ==
+						  PRF_RING_SIZE &&
+		   !prf_ring_stopped( p )) {
+		pthread_cond_wait( &p->room, &p->lock );
+	    }
+	    __atomic_store_n( &p->producer_asleep, 0, __ATOMIC_RELAXED );
+	    pthread_mutex_unlock( &p->lock );
+	    continue;
+	}
+	spins = 0;
+	unsigned slot = head & (PRF_RING_SIZE-1);
+	int index = next_prf_iter( p->value[slot], &p->iter );
+	p->index[slot] = index;
+	head++;
+	__atomic_store_n( &p->head, head, __ATOMIC_RELEASE );
+	wake_prf_ring( p, &p->consumer_asleep, &p->filled );
+
+	if (index < 0) return;      /* That was the last one */
+    }
+}
+
+static void *prf_producer( void *arg )
+{
+    struct prf_pipeline *p = arg;
+
+    pthread_mutex_lock( &p->lock );
+    for (;;) {
+	while (!p->busy && !p->quit) {
+	    pthread_cond_wait( &p->wake, &p->lock );
+	}
+	if (p->quit) break;
+	pthread_mutex_unlock( &p->lock );
+
+	fill_prf_ring( p );
+
+	pthread_mutex_lock( &p->lock );
+	p->busy = 0;
+	pthread_cond_signal( &p->idle );
+    }
+    pthread_mutex_unlock( &p->lock );
+    return 0;
+}
+
+static int next_prf_ring( unsigned char *output, struct prf_pipeline *p )
+{
+    unsigned tail = p->tail;
+    int spins;
+
+    /* Wait for the producer to get ahead of us */
+    for (spins = 0; __atomic_load_n( &p->head, __ATOMIC_ACQUIRE ) == tail;
+	 spins++) {
+	if (spins < PRF_RING_SPINS) {
+	    sched_yield();
+	    continue;
+	}
+	pthread_mutex_lock( &p->lock );
+	__atomic_store_n( &p->consumer_asleep, 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	while (__atomic_load_n( &p->head, __ATOMIC_ACQUIRE ) == tail) {
+	    pthread_cond_wait( &p->filled, &p->lock );
+	}
+	__atomic_store_n( &p->consumer_asleep, 0, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &p->lock );
+    }
+    unsigned slot = tail & (PRF_RING_SIZE-1);
+    int index = p->index[slot];
+    if (index < 0) {
+	return -1;      /* We hit the end; leave it there for next time */
+    }
+    memcpy( output, p->value[slot], 3*SPX_N );
+    memset( p->value[slot], 0, 3*SPX_N );
+    __atomic_store_n( &p->tail, tail + 1, __ATOMIC_RELEASE );
+    wake_prf_ring( p, &p->producer_asleep, &p->room );
+
+    return index;
 }
 
+/*
+ * Find an SMT sibling of cpu (another hardware thread on the same core),
+ * from the list (such as "3,67" or "2-3") that Linux gives.  Returns -1 if
+ * there is none
+ */
+static int smt_sibling( int cpu )
+{
+    char path[96], list[64];
+    const char *s = list;
+    char *end;
+    FILE *f;
+
+    snprintf( path, sizeof path,
+	      "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+	      cpu );
+    f = fopen( path, "r" );
+    if (!f) return -1;
+    if (!fgets( list, sizeof list, f )) list[0] = '\0';
+    fclose( f );
+
+    while (*s >= '0' && *s <= '9') {
+	long first = strtol( s, &end, 10 ), last = first;
+	if (*end == '-') {
+	    last = strtol( end + 1, &end, 10 );
+	}
+	for (; first <= last; first++) {
+	    if (first != cpu) return (int)first;
+	}
+	if (*end != ',') break;
+	s = end + 1;
+    }
+    return -1;
+}
+
+int create_prf_pipeline( spx_ctx *ctx )
+{
+    struct prf_pipeline *p;
+    pthread_attr_t attr;
+    cpu_set_t cpus, allowed;
+    void *mem;
+    int cpu, sibling;
+
+    ctx->prf_pipeline = 0;
+    if (posix_memalign( &mem, 64, sizeof *p )) return -1;
+    p = mem;
+    memset( p, 0, sizeof *p );
+    pthread_mutex_init( &p->lock, 0 );
+    pthread_cond_init( &p->wake, 0 );
+    pthread_cond_init( &p->idle, 0 );
+    pthread_cond_init( &p->room, 0 );
+    pthread_cond_init( &p->filled, 0 );
+    pthread_attr_init( &attr );
+
+    /* Put the producer on the other hardware thread of the core we're */
+    /* running on (if we're allowed to run there).  We leave our own */
+    /* affinity alone; that is our caller's business */
+    cpu = sched_getcpu();
+    sibling = cpu >= 0 ? smt_sibling( cpu ) : -1;
+    if (sibling >= 0 && sibling < CPU_SETSIZE &&
+	pthread_getaffinity_np( pthread_self(), sizeof allowed,
+				&allowed ) == 0 &&
+	CPU_ISSET( (size_t)sibling, &allowed )) {
+	CPU_ZERO( &cpus );
+	CPU_SET( (size_t)sibling, &cpus );
+	pthread_attr_setaffinity_np( &attr, sizeof cpus, &cpus );
+    }
+
+    if (pthread_create( &p->thread, &attr, prf_producer, p )) {
+	pthread_attr_destroy( &attr );
+	pthread_mutex_destroy( &p->lock );
+	pthread_cond_destroy( &p->wake );
+	pthread_cond_destroy( &p->idle );
+	pthread_cond_destroy( &p->room );
+	pthread_cond_destroy( &p->filled );
+	free( p );
+	return -1;
+    }
+    pthread_attr_destroy( &attr );
+    ctx->prf_pipeline = p;
+    return 0;
+}
+
+void destroy_prf_pipeline( spx_ctx *ctx )
+{
+    struct prf_pipeline *p = ctx->prf_pipeline;
+
+    if (!p) return;
+    pthread_mutex_lock( &p->lock );
+    __atomic_store_n( &p->quit, 1, __ATOMIC_RELAXED );
+    pthread_cond_signal( &p->wake );
+    pthread_cond_signal( &p->room );
+    pthread_mutex_unlock( &p->lock );
+    pthread_join( p->thread, 0 );
+
+    pthread_mutex_destroy( &p->lock );
+    pthread_cond_destroy( &p->wake );
+    pthread_cond_destroy( &p->idle );
+    pthread_cond_destroy( &p->room );
+    pthread_cond_destroy( &p->filled );
+    memset( p, 0, sizeof *p );
+    free( p );
+    ctx->prf_pipeline = 0;
+}
+
+int start_prf_pipeline( struct prf_iter *it )
+{
+    struct prf_pipeline *p = it->ctx->prf_pipeline;
+
+    if (!p) return -1;
+
+    /* The producer is idle (stop_prf_pipeline waited for that), so we */
+    /* can set up the ring for it */
+    p->iter = *it;
+    p->head = p->tail = 0;
+    p->abandon = 0;
+
+    pthread_mutex_lock( &p->lock );
+    p->busy = 1;
+    pthread_cond_signal( &p->wake );
+    pthread_mutex_unlock( &p->lock );
+
+    it->pipeline = p;
+    return 0;
+}
+
+void stop_prf_pipeline( struct prf_iter *it )
+{
+    struct prf_pipeline *p = it->pipeline;
+
+    if (!p) return;
+
+    /* Tell the producer to give up (waking it if it's waiting for room), */
+    /* and wait until it has */
+    __atomic_store_n( &p->abandon, 1, __ATOMIC_RELAXED );
+    pthread_mutex_lock( &p->lock );
+    pthread_cond_signal( &p->room );
+    while (p->busy) {
+	pthread_cond_wait( &p->idle, &p->lock );
+    }
+    pthread_mutex_unlock( &p->lock );
+
+    /* And wipe what it computed */
+    memset( &p->iter, 0, sizeof p->iter );
+    memset( p->value, 0, sizeof p->value );
+    it->pipeline = 0;
+}
+#else
+int create_prf_pipeline( spx_ctx *ctx )
+{
+    ctx->prf_pipeline = 0;
+    return -1;
+}
+
+void destroy_prf_pipeline( spx_ctx *ctx )
+{
+    (void)ctx;
+}
+
+int start_prf_pipeline( struct prf_iter *it )
+{
+    (void)it;
+    return -1;
+}
+
+void stop_prf_pipeline( struct prf_iter *it )
+{
+    (void)it;
+}
+#endif
+
 /*
  * Output the next node from the prf tree.  This returns the index being
  * output, or -1 if we've reached the end
  */
 int next_prf_iter( unsigned char *output, struct prf_iter *it )
 {
+#if defined(SPX_PRF_PIPELINE)
+    if (it->pipeline) return next_prf_ring( output, it->pipeline );
+#endif
     if (it->cur_node == -1) return -1;  /* We hit the end */
 
         /* This leaf value was computed the last iteration */
@@ -198,18 +567,29 @@ static uint64_t shiftr( uint64_t val, int shift )
  */
 void initialize_prf_key(uint64_t tree, uint32_t idx_leaf, spx_ctx *ctx)
 {
-    const unsigned char *parent_seed = ctx->sk_seed;
-
     /*
      * The seed for the top Merkle tree is the ultimate root key
      */
     memcpy( ctx->merkle_key[SPX_D-1], ctx->sk_seed, 3 * SPX_N );
 
+    initialize_prf_key_from(tree, idx_leaf, ctx, SPX_D-1);
+}
+
+/*
+ * This is initialize_prf_key, for when the keys for the Merkle trees at
+ * levels top_level and above are already in the ctx; this derives the
+ * ones below that (and the FORS seed)
+ */
+void initialize_prf_key_from(uint64_t tree, uint32_t idx_leaf, spx_ctx *ctx,
+                             int top_level)
+{
+    const unsigned char *parent_seed = ctx->merkle_key[top_level];
+
     /*
      * Go through each Merkle tree, and generate the root key for it (and the
      * seed for the next Merkle tree
      */
-    for (int level=SPX_D-1, tree_shift = SPX_FULL_HEIGHT - SPX_TREE_HEIGHT;
+    for (int level=top_level, tree_shift = top_level * SPX_TREE_HEIGHT;
 		       level>=0; level--, tree_shift -= SPX_TREE_HEIGHT) {
         uint32_t addr[8] = {0};
 	unsigned char *child_seed;
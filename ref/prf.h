@@ -13,6 +13,14 @@
 void initialize_prf_key(uint64_t tree, uint32_t idx_leaf,
 			spx_ctx *ctx);
 
+/*
+ * This does the same, when the keys for the Merkle trees at level top_level
+ * and above are already in the ctx
+ */
+#define initialize_prf_key_from SPX_NAMESPACE(initialize_prf_key_from)
+void initialize_prf_key_from(uint64_t tree, uint32_t idx_leaf,
+			spx_ctx *ctx, int top_level);
+
 /*
  * This evaluates a single node in a PRF tree.
  * If you need more than one, consider using a PRF iterator (below)
@@ -36,6 +44,8 @@ struct prf_iter {
     const spx_ctx *ctx;
     uint32_t addr[8];
     unsigned char node_value[12][3*SPX_N];
+    struct prf_pipeline *pipeline;  /* If nonzero, the pipeline that is */
+                                    /* running this iterator for us */
 };
 
 /* Initialize the above structure to go through the tree leaves */
@@ -44,8 +54,52 @@ void initialize_prf_iter( struct prf_iter *iter, int n, int stop_value,
                           const unsigned char *seed, const spx_ctx *ctx,
 			  const uint32_t addr[8] );
 
+/* Initialize the above structure to start at leaf start_value */
+#define initialize_prf_iter_at SPX_NAMESPACE(initialize_prf_iter_at)
+void initialize_prf_iter_at( struct prf_iter *iter, int n, int start_value,
+                          int stop_value,
+                          const unsigned char *seed, const spx_ctx *ctx,
+			  const uint32_t addr[8] );
+
 /* Generate the next tree leaf */
 #define next_prf_iter SPX_NAMESPACE(next_prf_iter)
 int next_prf_iter( unsigned char *output, struct prf_iter *iter );
 
+/*
+ * If built with SPX_PRF_PIPELINE, this starts a thread that will expand the
+ * PRF trees for the signing (or key generation) using ctx, so that they are
+ * expanded while we're running the F chains.  The one thread serves every
+ * tree of the operation.  If the core we're on has an SMT sibling, the
+ * thread is pinned to it (the calling thread's affinity is not changed).
+ * If not built for it (or if the thread can't
+ * be started), this leaves ctx->prf_pipeline zero, and the iterators
+ * compute the values themselves.
+ * Returns 0 if the pipeline is running, -1 if not
+ */
+#define create_prf_pipeline SPX_NAMESPACE(create_prf_pipeline)
+int create_prf_pipeline( spx_ctx *ctx );
+
+/*
+ * Stop the thread and wipe everything it has.  This must be called before
+ * ctx goes away
+ */
+#define destroy_prf_pipeline SPX_NAMESPACE(destroy_prf_pipeline)
+void destroy_prf_pipeline( spx_ctx *ctx );
+
+/*
+ * Hand the iterator to the ctx's pipeline (if it has one), which runs it
+ * ahead of us into a ring buffer; next_prf_iter then just takes values off
+ * the ring.  Returns 0 if the pipeline took it, -1 if not
+ */
+#define start_prf_pipeline SPX_NAMESPACE(start_prf_pipeline)
+int start_prf_pipeline( struct prf_iter *iter );
+
+/*
+ * Take the iterator back from the pipeline (if it has it), and wipe the
+ * values it had computed ahead.  This must be called before the iterator
+ * goes away; the pipeline is then free for the next tree
+ */
+#define stop_prf_pipeline SPX_NAMESPACE(stop_prf_pipeline)
+void stop_prf_pipeline( struct prf_iter *iter );
+
 #endif
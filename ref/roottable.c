@@ -0,0 +1,507 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE             /* For flock */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "api.h"
+#include "params.h"
+#include "roottable.h"
+
+/*
+ * This is the table of authenticated subtree roots; the same layout is used
+ * whether it lives in private memory or in a shared memory segment
+ */
+
+#define ROOT_TABLE_MAGIC 0x52585053  /* "SPXR" */
+#define ROOT_TABLE_LAYOUT 3         /* Bumped whenever root_entry changes */
+#define ROOT_TABLE_PARAMS \
+    ((uint32_t)SPX_N | ((uint32_t)SPX_D << 8) | \
+     ((uint32_t)SPX_TREE_HEIGHT << 16) | ((uint32_t)ROOT_TABLE_LAYOUT << 24))
+
+/* How many consecutive slots a root may be in */
+#define ROOT_TABLE_PROBES 4
+
+/* How long we'll wait for another process to start setting up a shared */
+/* table (once it has, we wait for as long as it is alive) */
+#define ROOT_TABLE_WAIT_MS 1000
+
+struct table_header {
+    uint32_t magic;             /* Written last, once the rest is set up */
+    uint32_t params;            /* The parameter set this table is for */
+    uint32_t num_entries;       /* A power of 2 */
+    uint32_t reserved;
+    unsigned char pk[SPX_PK_BYTES];
+};
+
+/*
+ * One root, along with the digest of the signature layers above its tree
+ * (see spx_root_table_lookup).  The low half of seq is 0 if the entry has
+ * never been written, odd while it is being written, and is bumped by 2
+ * every time it is rewritten; while it is odd, the high half is the pid of
+ * the writer, so that an entry whose writer died halfway can be reclaimed.
+ * All the fields are accessed with atomic loads and stores, so that a
+ * reader racing a writer sees a stale or torn entry (which the seq check
+ * then rejects), rather than undefined behavior
+ */
+struct root_entry {
+    uint64_t seq;
+    uint64_t tree;
+    uint32_t layer;
+    uint32_t reserved;
+    uint64_t root[SPX_N / 8];
+    uint64_t above[SPX_N / 8];
+};
+
+/* The entries start on a cache line boundary after the header */
+#define ENTRIES_OFFSET ((sizeof(struct table_header) + 63) & ~(size_t)63)
+
+struct spx_root_table {
+    unsigned char pk[SPX_PK_BYTES];
+    struct table_header *header;
+    struct root_entry *entries;
+    uint32_t mask;
+    void *map;                  /* The shared mapping (0 if private) */
+    size_t map_size;
+};
+
+static size_t table_size(uint32_t num_entries)
+{
+    return ENTRIES_OFFSET + num_entries * sizeof(struct root_entry);
+}
+
+static uint32_t round_entries(unsigned num_entries)
+{
+    uint32_t n;
+
+    for (n = ROOT_TABLE_PROBES; n < num_entries && n < (1U << 30); n *= 2)
+        ;
+    return n;
+}
+
+static uint32_t home_slot(const struct spx_root_table *t,
+                          uint32_t layer, uint64_t tree)
+{
+    uint64_t hash = (tree + ((uint64_t)layer << 58)) * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(hash >> 32) & t->mask;
+}
+
+/* Whether seq says the entry holds a root (it isn't empty or being written) */
+static int entry_valid(uint64_t seq)
+{
+    return (uint32_t)seq != 0 && !(seq & 1);
+}
+
+/*
+ * Read the entry e; returns its sequence number if we got a consistent copy
+ * of a valid entry, 0 if not
+ */
+static uint64_t read_entry(const struct root_entry *e, uint32_t *layer,
+                           uint64_t *tree, uint64_t *root, uint64_t *above)
+{
+    uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    unsigned i;
+
+    if (!entry_valid(seq)) {
+        return 0;
+    }
+    *layer = __atomic_load_n(&e->layer, __ATOMIC_RELAXED);
+    *tree = __atomic_load_n(&e->tree, __ATOMIC_RELAXED);
+    for (i = 0; i < SPX_N / 8; i++) {
+        root[i] = __atomic_load_n(&e->root[i], __ATOMIC_RELAXED);
+        above[i] = __atomic_load_n(&e->above[i], __ATOMIC_RELAXED);
+    }
+
+    /* Make sure the loads above are done before we recheck seq */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) {
+        return 0;
+    }
+    return seq;
+}
+
+/*
+ * Whether the process that was writing an entry (whose seq is odd) is gone,
+ * so that it will never finish
+ */
+static int writer_died(uint64_t seq)
+{
+    return kill((pid_t)(seq >> 32), 0) != 0 && errno == ESRCH;
+}
+
+/*
+ * Rewrite the entry e, unless someone else is writing it right now (in
+ * which case we leave it to them); if the one writing it died before it
+ * finished, we take the entry over
+ */
+static void write_entry(struct root_entry *e, uint32_t layer, uint64_t tree,
+                        const uint64_t *root, const uint64_t *above)
+{
+    uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    uint32_t count = (uint32_t)seq;
+    unsigned i;
+
+    if (seq & 1) {
+        if (!writer_died(seq)) {
+            return;
+        }
+        count += 1;     /* Odd again after the + 1 below */
+    }
+    count += 1;
+    if (!__atomic_compare_exchange_n(&e->seq, &seq,
+                                     ((uint64_t)getpid() << 32) | count, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    /* Make sure the odd seq is visible before any of the stores below */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&e->layer, layer, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->tree, tree, __ATOMIC_RELAXED);
+    for (i = 0; i < SPX_N / 8; i++) {
+        __atomic_store_n(&e->root[i], root[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&e->above[i], above[i], __ATOMIC_RELAXED);
+    }
+
+    /* Skip 0 when it wraps; that means 'never written' */
+    count += 1;
+    if (count == 0) {
+        count = 2;
+    }
+    __atomic_store_n(&e->seq, (uint64_t)count, __ATOMIC_RELEASE);
+}
+
+int spx_root_table_lookup(struct spx_root_table *t,
+                          uint32_t layer, uint64_t tree, unsigned char *root,
+                          unsigned char *above)
+{
+    uint32_t slot = home_slot(t, layer, tree);
+    uint32_t e_layer;
+    uint64_t e_tree;
+    uint64_t e_root[SPX_N / 8];
+    uint64_t e_above[SPX_N / 8];
+    unsigned i;
+
+    for (i = 0; i < ROOT_TABLE_PROBES; i++) {
+        const struct root_entry *e = &t->entries[(slot + i) & t->mask];
+        if (read_entry(e, &e_layer, &e_tree, e_root, e_above) &&
+            e_layer == layer && e_tree == tree) {
+            memcpy(root, e_root, SPX_N);
+            memcpy(above, e_above, SPX_N);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void spx_root_table_store(struct spx_root_table *t,
+                          uint32_t layer, uint64_t tree,
+                          const unsigned char *root,
+                          const unsigned char *above)
+{
+    uint32_t slot = home_slot(t, layer, tree);
+    struct root_entry *victim = 0;
+    uint32_t e_layer;
+    uint64_t e_tree;
+    uint64_t e_root[SPX_N / 8];
+    uint64_t e_above[SPX_N / 8];
+    uint64_t new_root[SPX_N / 8];
+    uint64_t new_above[SPX_N / 8];
+    unsigned i;
+
+    for (i = 0; i < ROOT_TABLE_PROBES; i++) {
+        struct root_entry *e = &t->entries[(slot + i) & t->mask];
+        if (read_entry(e, &e_layer, &e_tree, e_root, e_above)) {
+            if (e_layer == layer && e_tree == tree) {
+                return;     /* Someone beat us to it */
+            }
+        } else if (!victim) {
+            /* An empty slot, or one whose writer died on it */
+            uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+            if (seq == 0 || ((seq & 1) && writer_died(seq))) {
+                victim = e;
+            }
+        }
+    }
+
+    /* If there's no empty slot, evict one; the roots of the higher layers */
+    /* are the most valuable, so we prefer to evict the lowest one */
+    if (!victim) {
+        uint32_t lowest = SPX_D;
+        for (i = 0; i < ROOT_TABLE_PROBES; i++) {
+            struct root_entry *e = &t->entries[(slot + i) & t->mask];
+            if (read_entry(e, &e_layer, &e_tree, e_root, e_above) && e_layer < lowest) {
+                lowest = e_layer;
+                victim = e;
+            }
+        }
+        if (!victim || lowest > layer) {
+            return;
+        }
+    }
+
+    memcpy(new_root, root, SPX_N);
+    memcpy(new_above, above, SPX_N);
+    write_entry(victim, layer, tree, new_root, new_above);
+}
+
+unsigned spx_root_table_count(struct spx_root_table *t)
+{
+    unsigned count = 0;
+    uint32_t i;
+
+    for (i = 0; i <= t->mask; i++) {
+        if (entry_valid(__atomic_load_n(&t->entries[i].seq,
+                                        __ATOMIC_RELAXED))) {
+            count++;
+        }
+    }
+    return count;
+}
+
+struct spx_root_table *spx_root_table_create(const unsigned char *pk,
+                                             unsigned num_entries)
+{
+    struct spx_root_table *t = calloc(1, sizeof *t);
+    uint32_t n = round_entries(num_entries);
+    void *p;
+    unsigned char *mem;
+
+    if (!t) return 0;
+    memcpy(t->pk, pk, SPX_PK_BYTES);
+    if (posix_memalign(&p, 64, table_size(n))) {
+        free(t);
+        return 0;
+    }
+    mem = p;
+    memset(mem, 0, table_size(n));
+
+    t->header = (struct table_header *)mem;
+    t->entries = (struct root_entry *)(mem + ENTRIES_OFFSET);
+    t->mask = n - 1;
+    t->header->params = ROOT_TABLE_PARAMS;
+    t->header->num_entries = n;
+    memcpy(t->header->pk, pk, SPX_PK_BYTES);
+    t->header->magic = ROOT_TABLE_MAGIC;
+
+    return t;
+}
+
+static void sleep_ms(void)
+{
+    struct timespec delay = { 0, 1000000 };
+    nanosleep(&delay, 0);
+}
+
+/*
+ * Check that a segment someone else created is one we can trust: it must
+ * be ours, and nobody else may have access to it.  Otherwise another user
+ * could have created it first, with the right header and forged roots
+ */
+static int trusted_segment(const struct stat *st)
+{
+    return st->st_uid == geteuid() && (st->st_mode & 077) == 0;
+}
+
+/*
+ * Check whether the segment open on fd is set up (its magic is written).
+ * Returns 1 if it is (with st describing it), 0 if not yet, and -1 if we
+ * can't use it
+ */
+static int segment_ready(int fd, struct stat *st)
+{
+    struct table_header *header;
+    uint32_t magic;
+
+    if (fstat(fd, st) || !trusted_segment(st)) {
+        return -1;
+    }
+    if ((size_t)st->st_size < sizeof *header) {
+        return 0;
+    }
+    header = mmap(0, sizeof *header, PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        return -1;
+    }
+    magic = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE);
+    munmap(header, sizeof *header);
+    return magic == ROOT_TABLE_MAGIC;
+}
+
+/*
+ * Wait for whoever created the segment open on fd to set it up.  The
+ * creator holds an exclusive lock on the segment until it has, so while
+ * the lock is held the creator is alive and at work, and we wait for as
+ * long as it takes.  If we find the segment unlocked and not set up, its
+ * creator has either not taken the lock yet, or died; we give it
+ * ROOT_TABLE_WAIT_MS to show up before deciding it is dead.  Returns 0 once
+ * the segment is set up (with st describing it), -1 if we can't use it,
+ * and 1 if it will never be set up
+ */
+static int wait_for_creator(int fd, struct stat *st)
+{
+    int creator_gone = 0;
+    int ready;
+    int i;
+
+    for (i = 0; ; i++) {
+        if (flock(fd, LOCK_SH | LOCK_NB)) {
+            if (errno != EWOULDBLOCK || flock(fd, LOCK_SH)) {
+                return -1;
+            }
+            /* The creator let go; it is either done or dead */
+            creator_gone = 1;
+        }
+        ready = segment_ready(fd, st);
+        flock(fd, LOCK_UN);
+
+        if (ready) {
+            return ready > 0 ? 0 : -1;
+        }
+        if (creator_gone || i == ROOT_TABLE_WAIT_MS) {
+            return 1;
+        }
+        sleep_ms();
+    }
+}
+
+/*
+ * Map the segment 'name' (creating it if need be) into t.  Returns 0 on
+ * success, -1 on failure, and 1 if the segment exists but will never be
+ * set up (its creator died before sizing it or writing the magic)
+ */
+static int attach_shared(struct spx_root_table *t, const char *name,
+                         const unsigned char *pk, uint32_t n)
+{
+    struct table_header *header;
+    struct stat st;
+    size_t size = table_size(n);
+    int created = 0;
+    int ret = -1;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        /* We hold the lock while we set it up, so that the others can */
+        /* tell we are still alive (if we die, it goes with us) */
+        created = 1;
+        if (flock(fd, LOCK_EX) || ftruncate(fd, (off_t)size)) {
+            goto fail;
+        }
+    } else if (errno == EEXIST) {
+        /* Someone else created it; it may not be set up yet */
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) {
+            goto fail;
+        }
+        ret = wait_for_creator(fd, &st);
+        if (ret) {
+            goto fail;
+        }
+        ret = -1;
+        size = (size_t)st.st_size;
+        if (size < ENTRIES_OFFSET) {
+            goto fail;
+        }
+    } else {
+        goto fail;
+    }
+
+    t->map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (t->map == MAP_FAILED) {
+        t->map = 0;
+        goto fail;
+    }
+    t->map_size = size;
+    header = t->map;
+
+    if (created) {
+        header->params = ROOT_TABLE_PARAMS;
+        header->num_entries = n;
+        memcpy(header->pk, pk, SPX_PK_BYTES);
+        __atomic_store_n(&header->magic, ROOT_TABLE_MAGIC, __ATOMIC_RELEASE);
+
+        /* The mapping keeps the lock alive past close(), so let go now */
+        flock(fd, LOCK_UN);
+    } else {
+        n = header->num_entries;
+        if (header->params != ROOT_TABLE_PARAMS ||
+            n < ROOT_TABLE_PROBES || (n & (n - 1)) ||
+            table_size(n) > size ||
+            memcmp(header->pk, pk, SPX_PK_BYTES)) {
+            goto fail;
+        }
+    }
+
+    close(fd);
+    t->header = header;
+    t->entries = (struct root_entry *)((unsigned char *)t->map +
+                                       ENTRIES_OFFSET);
+    t->mask = n - 1;
+    return 0;
+
+fail:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (created) {
+        shm_unlink(name);
+    }
+    if (t->map) {
+        munmap(t->map, t->map_size);
+        t->map = 0;
+    }
+    return ret;
+}
+
+struct spx_root_table *spx_root_table_open_shared(const char *name,
+                                                  const unsigned char *pk,
+                                                  unsigned num_entries)
+{
+    struct spx_root_table *t = calloc(1, sizeof *t);
+    int ret;
+
+    if (!t) return 0;
+    memcpy(t->pk, pk, SPX_PK_BYTES);
+
+    ret = attach_shared(t, name, pk, round_entries(num_entries));
+    if (ret == 1) {
+        /* A stale segment (ours, as attach_shared checked) that will */
+        /* never be set up; get rid of it, and start over */
+        shm_unlink(name);
+        ret = attach_shared(t, name, pk, round_entries(num_entries));
+    }
+    if (ret != 0) {
+        free(t);
+        return 0;
+    }
+    return t;
+}
+
+void spx_root_table_close(struct spx_root_table *t)
+{
+    if (!t) return;
+
+    if (t->map) {
+        munmap(t->map, t->map_size);
+    } else {
+        free(t->header);
+    }
+    free(t);
+}
+
+int spx_root_table_verify(struct spx_root_table *t,
+                          const uint8_t *sig, size_t siglen,
+                          const uint8_t *m, size_t mlen)
+{
+    return spx_verify_internal(sig, siglen, m, mlen, t->pk, t);
+}
@@ -0,0 +1,107 @@
+#if !defined( ROOTTABLE_H_ )
+#define ROOTTABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "params.h"
+
+/*
+ * A root table remembers, for one public key, the roots of hypertree
+ * subtrees (below the top layer) that have been authenticated by a
+ * successful verification.  The root of the tree at (layer, tree) is the
+ * same in every signature that goes through that tree, and so are the
+ * signature layers above it (the WOTS signatures and authentication paths
+ * that hash that root up to the public key).  Hence, once we know both, a
+ * later verification that computes the same root for that tree, and whose
+ * layers above it are the same, can stop there, without walking them.
+ *
+ * The table can either be private to the process, or live in a POSIX
+ * shared memory segment, so that all the verifiers on a host (which may be
+ * many short lived processes) share what any of them has learned.  Lookups
+ * take no locks; each entry carries a sequence number that is odd while the
+ * entry is being written, and readers retry (or just miss) if it changed
+ * under them.
+ *
+ * Anyone who can write to the shared segment can make forgeries verify.
+ * We create the segment with mode 0600, and we only use a segment that
+ * already exists if it belongs to our effective user and nobody else has
+ * any access to it; so only processes running as the same user can plant
+ * roots.  (A segment whose creator died before setting it up is removed
+ * and created afresh.)
+ */
+struct spx_root_table;
+
+/*
+ * Create a root table private to this process, with room for num_entries
+ * roots (rounded up to a power of 2).  Returns 0 on failure
+ */
+struct spx_root_table *spx_root_table_create(const unsigned char *pk,
+                                             unsigned num_entries);
+
+/*
+ * Open the root table in the shared memory segment 'name' (which is passed
+ * to shm_open, and so should start with a '/'), creating it if it doesn't
+ * exist yet.  Returns 0 on failure, or if the segment holds the table for
+ * a different public key or parameter set
+ */
+struct spx_root_table *spx_root_table_open_shared(const char *name,
+                                                  const unsigned char *pk,
+                                                  unsigned num_entries);
+
+/*
+ * Release the table.  For a shared table, this unmaps the segment; the
+ * segment itself stays around for the other processes (use shm_unlink to
+ * get rid of it)
+ */
+void spx_root_table_close(struct spx_root_table *table);
+
+/*
+ * Returns the number of roots in the table
+ */
+unsigned spx_root_table_count(struct spx_root_table *table);
+
+/*
+ * Verifies a detached signature and message under the table's public key,
+ * using (and adding to) the table.  Returns 0 if the signature is valid,
+ * -1 if not
+ */
+int spx_root_table_verify(struct spx_root_table *table,
+                          const uint8_t *sig, size_t siglen,
+                          const uint8_t *m, size_t mlen);
+
+/*
+ * The rest of this is the interface between the table and the verification
+ * logic in sign.c
+ */
+
+/*
+ * Look up the root of the tree at (layer, tree).  Returns 1 (and writes
+ * root, and above, the digest of the signature layers above that tree) if
+ * we have it, 0 if not
+ */
+#define spx_root_table_lookup SPX_NAMESPACE(spx_root_table_lookup)
+int spx_root_table_lookup(struct spx_root_table *table,
+                          uint32_t layer, uint64_t tree, unsigned char *root,
+                          unsigned char *above);
+
+/*
+ * Record the (authenticated) root of the tree at (layer, tree), and the
+ * digest of the signature layers above it
+ */
+#define spx_root_table_store SPX_NAMESPACE(spx_root_table_store)
+void spx_root_table_store(struct spx_root_table *table,
+                          uint32_t layer, uint64_t tree,
+                          const unsigned char *root,
+                          const unsigned char *above);
+
+/*
+ * Verify a detached signature, consulting the table (if nonzero).  This is
+ * what crypto_sign_verify is built on
+ */
+#define spx_verify_internal SPX_NAMESPACE(spx_verify_internal)
+int spx_verify_internal(const uint8_t *sig, size_t siglen,
+                        const uint8_t *m, size_t mlen, const uint8_t *pk,
+                        struct spx_root_table *table);
+
+#endif /* ROOTTABLE_H_ */
@@ -9,10 +9,13 @@
 #include "hash.h"
 #include "thash.h"
 #include "address.h"
+#include "fips202.h"
 #include "randombytes.h"
 #include "utils.h"
 #include "merkle.h"
 #include "prf.h"
+#include "signer.h"
+#include "roottable.h"
 
 /*
  * Returns the length of a secret key, in bytes
@@ -46,6 +49,14 @@ unsigned long long crypto_sign_seedbytes(void)
     return CRYPTO_SEEDBYTES;
 }
 
+/*
+ * Returns the private key format
+ */
+unsigned long long crypto_sign_keyformat(void)
+{
+    return CRYPTO_KEYFORMAT;
+}
+
 /*
  * Generates an SPX key pair given a seed of length
  * Format sk: [SK_SEED || SK_PRF || PUB_SEED || root]
@@ -53,8 +64,19 @@ unsigned long long crypto_sign_seedbytes(void)
  */
 int crypto_sign_seed_keypair(unsigned char *pk, unsigned char *sk,
                              const unsigned char *seed)
+{
+    return spx_seed_keypair_cancellable(pk, sk, seed, 0);
+}
+
+/*
+ * Generates an SPX key pair given a seed, giving up (and wiping pk and sk)
+ * if *cancel is set
+ */
+int spx_seed_keypair_cancellable(unsigned char *pk, unsigned char *sk,
+                                 const unsigned char *seed, const int *cancel)
 {
     spx_ctx ctx;
+    int ret;
 
     /* Initialize SK_SEED, SK_PRF and PUB_SEED from seed. */
     memcpy(sk, seed, CRYPTO_SEEDBYTES);
@@ -63,6 +85,7 @@ int crypto_sign_seed_keypair(unsigned char *pk, unsigned char *sk,
 
     memcpy(ctx.pub_seed, pk, SPX_N);
     memcpy(ctx.sk_seed, sk, 3*SPX_N);
+    ctx.cancel = cancel;
 
     /* This hook allows the hash function instantiation to do whatever
        preparation or computation it needs, based on the public seed. */
@@ -72,8 +95,18 @@ int crypto_sign_seed_keypair(unsigned char *pk, unsigned char *sk,
        top level Merkle tree, and that doesn't depend on the message) */
     initialize_prf_key(0, 0, &ctx );
 
+    /* Start the PRF pipeline, if we're built for that */
+    (void)create_prf_pipeline(&ctx);
+
     /* Compute root node of the top-most subtree. */
-    merkle_gen_root(sk + 5*SPX_N, &ctx);
+    ret = merkle_gen_root(sk + 5*SPX_N, &ctx);
+    destroy_prf_pipeline(&ctx);
+    if (ret) {
+        memset(&ctx, 0, sizeof ctx);
+        memset(sk, 0, SPX_SK_BYTES);
+        memset(pk, 0, SPX_PK_BYTES);
+        return SPX_CANCELLED;
+    }
 
     memcpy(pk + SPX_N, sk + 5*SPX_N, SPX_N);
 
@@ -96,9 +129,24 @@ int crypto_sign_keypair(unsigned char *pk, unsigned char *sk)
 
 /**
  * Returns an array containing a detached signature.
+ * Returns 0 on success, -1 if a fault was detected, or if the private key is
+ * not of this build's key format (in which case no signature is released)
  */
 int crypto_sign_signature(uint8_t *sig, size_t *siglen,
                           const uint8_t *m, size_t mlen, const uint8_t *sk)
+{
+    struct spx_prepared prepared;
+
+    spx_sign_prepare(&prepared, m, mlen, sk);
+    return spx_sign_internal(sig, siglen, &prepared, sk, 0, 0);
+}
+
+/**
+ * The first (cheap) phase of signing; this computes the randomizer R and
+ * hashes the message, which decides the hypertree path
+ */
+int spx_sign_prepare(struct spx_prepared *prepared,
+                     const uint8_t *m, size_t mlen, const uint8_t *sk)
 {
     spx_ctx ctx;
 
@@ -106,16 +154,86 @@ int crypto_sign_signature(uint8_t *sig, size_t *siglen,
     const unsigned char *pk = sk + 4*SPX_N;
 
     unsigned char optrand[SPX_N];
-    unsigned char mhash[SPX_FORS_MSG_BYTES];
+
+    memcpy(ctx.pub_seed, pk, SPX_N);
+
+    /* This hook allows the hash function instantiation to do whatever
+       preparation or computation it needs, based on the public seed. */
+    initialize_hash_function(&ctx);
+
+    /* We need to make signing nondetermistic */
+    randombytes(optrand, SPX_N);
+    /* Compute the digest randomization value. */
+    gen_message_random(prepared->R, sk_prf, optrand, m, mlen, &ctx);
+
+    /* Derive the message digest and leaf index from R, PK and M. */
+    hash_message(prepared->mhash, &prepared->tree, &prepared->idx_leaf,
+                 prepared->R, pk, m, mlen, &ctx);
+
+    return 0;
+}
+
+/**
+ * The second (heavy) phase of signing
+ */
+int spx_sign_complete(uint8_t *sig, size_t *siglen,
+                      const struct spx_prepared *prepared, const uint8_t *sk)
+{
+    return spx_sign_internal(sig, siglen, prepared, sk, 0, 0);
+}
+
+/**
+ * The second phase of signing, giving up if *cancel is set
+ */
+int spx_sign_complete_cancellable(uint8_t *sig, size_t *siglen,
+                                  const struct spx_prepared *prepared,
+                                  const uint8_t *sk, const int *cancel)
+{
+    return spx_sign_internal(sig, siglen, prepared, sk, 0, cancel);
+}
+
+/**
+ * Generates a detached signature for a prepared message; if signer is
+ * nonzero, any Merkle trees (and WOTS signatures) it has cached are used
+ * rather than recomputed.  If cancel is nonzero, we check it before each
+ * layer, FORS tree and Merkle leaf, and give up once it is set
+ */
+int spx_sign_internal(uint8_t *sig, size_t *siglen,
+                      const struct spx_prepared *prepared, const uint8_t *sk,
+                      struct spx_signer *signer, const int *cancel)
+{
+    spx_ctx ctx;
+
+    const unsigned char *pk = sk + 4*SPX_N;
+
     unsigned char root[SPX_N];
+    unsigned char next_root[SPX_N];
+    const unsigned char *mhash = prepared->mhash;
     uint32_t i;
-    uint64_t tree;
-    uint32_t idx_leaf;
+    uint64_t tree = prepared->tree;
+    uint32_t idx_leaf = prepared->idx_leaf;
     uint32_t wots_addr[8] = {0};
     uint32_t tree_addr[8] = {0};
+    uint8_t *sig_start = sig;
+    int fault = 0;
+    int ret;
+
+    /* The prepared message may have come from elsewhere; make sure the */
+    /* path is one that hash_message could have produced */
+    if (idx_leaf >= (1U << SPX_TREE_HEIGHT)) {
+        *siglen = 0;
+        return -1;
+    }
+#if SPX_TREE_HEIGHT * (SPX_D - 1) < 64
+    if (tree >> (SPX_TREE_HEIGHT * (SPX_D - 1))) {
+        *siglen = 0;
+        return -1;
+    }
+#endif
 
     memcpy(ctx.sk_seed, sk, 3*SPX_N);
     memcpy(ctx.pub_seed, pk, SPX_N);
+    ctx.cancel = cancel;
 
     /* This hook allows the hash function instantiation to do whatever
        preparation or computation it needs, based on the public seed. */
@@ -124,43 +242,108 @@ int crypto_sign_signature(uint8_t *sig, size_t *siglen,
     set_type(wots_addr, SPX_ADDR_TYPE_WOTS);
     set_type(tree_addr, SPX_ADDR_TYPE_HASHTREE);
 
-    /* We need to make signing nondetermistic */
-    randombytes(optrand, SPX_N);
-    /* Compute the digest randomization value. */
-    gen_message_random(sig, sk_prf, optrand, m, mlen, &ctx);
-
-    /* Derive the message digest and leaf index from R, PK and M. */
-    hash_message(mhash, &tree, &idx_leaf, sig, pk, m, mlen, &ctx);
+    memcpy(sig, prepared->R, SPX_N);
     sig += SPX_N;
 
     /* Generate the subkeys for each of the Merkle and FORS trees */
-    initialize_prf_key(tree, idx_leaf, &ctx);
+    if (signer) {
+        spx_signer_prf_keys(signer, tree, idx_leaf, &ctx);
+    } else {
+        initialize_prf_key(tree, idx_leaf, &ctx);
+    }
 
     set_tree_addr(wots_addr, tree);
     set_keypair_addr(wots_addr, idx_leaf);
 
+    /* Start the PRF pipeline (one thread for all the trees we'll be */
+    /* expanding), if we're built for that */
+    (void)create_prf_pipeline(&ctx);
+
     /* Sign the message hash using FORS. */
-    fors_sign(sig, root, mhash, &ctx, wots_addr);
+    ret = fors_sign(sig, root, mhash, &ctx, wots_addr);
+    if (ret == SPX_CANCELLED) {
+        goto cancelled;
+    }
+    fault |= ret;
     sig += SPX_FORS_BYTES;
 
     for (i = 0; i < SPX_D; i++) {
+        if (spx_cancelled(&ctx)) {
+            goto cancelled;
+        }
+
         set_layer_addr(tree_addr, i);
         set_tree_addr(tree_addr, tree);
 
         copy_subtree_addr(wots_addr, tree_addr);
         set_keypair_addr(wots_addr, idx_leaf);
 
-        merkle_sign(sig, root, &ctx, wots_addr, tree_addr, idx_leaf);
+        switch (signer ? spx_signer_lookup(signer, i, tree, idx_leaf, sig,
+                                   sig + SPX_WOTS_BYTES, next_root)
+                       : SPX_CACHE_MISS) {
+        case SPX_CACHE_SIG:
+            /* The whole Merkle signature was cached */
+            memcpy(root, next_root, SPX_N);
+            break;
+        case SPX_CACHE_TREE:
+            /* We have the auth path and the root; we just need to sign */
+            ret = merkle_sign_wots(sig, root, &ctx, i, tree, idx_leaf);
+            if (ret == SPX_CANCELLED) {
+                goto cancelled;
+            }
+            if (ret) {
+                fault = 1;
+            } else if (i > 0) {
+                /* Above the bottom layer, the message (the root of the */
+                /* tree below) is always the same; remember the signature */
+                spx_signer_store_wots(signer, i, tree, idx_leaf, sig);
+            }
+            memcpy(root, next_root, SPX_N);
+            break;
+        default:
+            ret = merkle_sign(sig, root, &ctx, wots_addr, tree_addr,
+                              idx_leaf);
+            if (ret == SPX_CANCELLED) {
+                goto cancelled;
+            }
+            fault |= ret;
+            break;
+        }
         sig += SPX_WOTS_BYTES + SPX_TREE_HEIGHT * SPX_N;
 
         /* Update the indices for the next layer. */
         idx_leaf = (tree & ((1 << SPX_TREE_HEIGHT)-1));
         tree = tree >> SPX_TREE_HEIGHT;
     }
+    destroy_prf_pipeline(&ctx);
+
+    /* The top root must be the one in the key; if it isn't, the key is */
+    /* from the other key format (or is corrupt), and the signature won't */
+    /* verify */
+    if (memcmp(root, sk + 5*SPX_N, SPX_N)) {
+        fault = 1;
+    }
+
+    if (fault) {
+        /* A faulty signature may leak secret values; don't release it */
+        memset(sig_start, 0, SPX_BYTES);
+        *siglen = 0;
+        return -1;
+    }
 
     *siglen = SPX_BYTES;
 
     return 0;
+
+cancelled:
+    destroy_prf_pipeline(&ctx);
+
+    /* Nobody wants this signature any more; don't leave the parts we */
+    /* have done (or the keys) lying around */
+    memset(sig_start, 0, SPX_BYTES);
+    memset(&ctx, 0, sizeof ctx);
+    *siglen = 0;
+    return SPX_CANCELLED;
 }
 
 /**
@@ -168,6 +351,50 @@ int crypto_sign_signature(uint8_t *sig, size_t *siglen,
  */
 int crypto_sign_verify(const uint8_t *sig, size_t siglen,
                        const uint8_t *m, size_t mlen, const uint8_t *pk)
+{
+    return spx_verify_internal(sig, siglen, m, mlen, pk, 0);
+}
+
+/* The bytes one hypertree layer takes up in a signature */
+#define SPX_LAYER_BYTES (SPX_WOTS_BYTES + SPX_TREE_HEIGHT * SPX_N)
+
+/*
+ * Digest the signature layers above each subtree, for the root table:
+ * above[j] = SHAKE256(layer j+1 || above[j+1]), with above[SPX_D-1] empty.
+ * layers points to the first hypertree layer of the signature.  The digests
+ * down to above[*lowest] are already there; this fills in the ones down to
+ * above[layer], working from the top, and lowers *lowest to match
+ */
+static void digest_upper_layers(unsigned char above[SPX_D][SPX_N],
+                                unsigned *lowest, unsigned layer,
+                                const unsigned char *layers)
+{
+    uint64_t s_inc[26];
+
+    for (; *lowest > layer; (*lowest)--) {
+        unsigned j = *lowest - 1;
+
+        shake256_inc_init(s_inc);
+        shake256_inc_absorb(s_inc, layers + (j + 1) * SPX_LAYER_BYTES,
+                            SPX_LAYER_BYTES);
+        if (j + 1 < SPX_D - 1) {
+            shake256_inc_absorb(s_inc, above[j + 1], SPX_N);
+        }
+        shake256_inc_finalize(s_inc);
+        shake256_inc_squeeze(above[j], SPX_N, s_inc);
+    }
+}
+
+/**
+ * Verifies a detached signature, consulting (and adding to) the root table
+ * (if nonzero).  If we compute the root of a subtree that the table already
+ * knows, and the signature layers above it digest to what the table has
+ * for them, the signature is as good as one that hashes up to the public
+ * key, and so we stop there.
+ */
+int spx_verify_internal(const uint8_t *sig, size_t siglen,
+                        const uint8_t *m, size_t mlen, const uint8_t *pk,
+                        struct spx_root_table *table)
 {
     spx_ctx ctx;
     const unsigned char *pub_root = pk + SPX_N;
@@ -175,7 +402,14 @@ int crypto_sign_verify(const uint8_t *sig, size_t siglen,
     unsigned char wots_pk[SPX_WOTS_BYTES];
     unsigned char root[SPX_N];
     unsigned char leaf[SPX_N];
-    unsigned int i;
+    unsigned char known_root[SPX_N];
+    unsigned char known_above[SPX_N];
+    unsigned char roots[SPX_D][SPX_N];
+    unsigned char above[SPX_D][SPX_N];
+    unsigned lowest_above = SPX_D - 1;
+    const unsigned char *layers;
+    uint64_t trees[SPX_D];
+    unsigned int i, j;
     uint64_t tree;
     uint32_t idx_leaf;
     uint32_t wots_addr[8] = {0};
@@ -207,6 +441,7 @@ int crypto_sign_verify(const uint8_t *sig, size_t siglen,
 
     fors_pk_from_sig(root, sig, mhash, &ctx, wots_addr);
     sig += SPX_FORS_BYTES;
+    layers = sig;
 
     /* For each subtree.. */
     for (i = 0; i < SPX_D; i++) {
@@ -232,16 +467,40 @@ int crypto_sign_verify(const uint8_t *sig, size_t siglen,
                      &ctx, tree_addr);
         sig += SPX_TREE_HEIGHT * SPX_N;
 
+        if (table && i < SPX_D - 1) {
+            memcpy(roots[i], root, SPX_N);
+            trees[i] = tree;
+            /* A different upper part would be a different signature, */
+            /* which we have to check in full */
+            if (spx_root_table_lookup(table, i, tree, known_root,
+                                      known_above) &&
+                memcmp(root, known_root, SPX_N) == 0) {
+                digest_upper_layers(above, &lowest_above, i, layers);
+                if (memcmp(above[i], known_above, SPX_N) == 0) {
+                    break;
+                }
+            }
+        }
+
         /* Update the indices for the next layer. */
         idx_leaf = (tree & ((1 << SPX_TREE_HEIGHT)-1));
         tree = tree >> SPX_TREE_HEIGHT;
     }
 
     /* Check if the root node equals the root node in the public key. */
-    if (memcmp(root, pub_root, SPX_N)) {
+    if (i == SPX_D && memcmp(root, pub_root, SPX_N)) {
         return -1;
     }
 
+    /* The roots of the subtrees below where we stopped are now */
+    /* authenticated too */
+    if (table && i > 0) {
+        digest_upper_layers(above, &lowest_above, 0, layers);
+        for (j = 0; j < i && j < SPX_D - 1; j++) {
+            spx_root_table_store(table, j, trees[j], roots[j], above[j]);
+        }
+    }
+
     return 0;
 }
 
@@ -255,7 +514,10 @@ int crypto_sign(unsigned char *sm, unsigned long long *smlen,
 {
     size_t siglen;
 
-    crypto_sign_signature(sm, &siglen, m, (size_t)mlen, sk);
+    if (crypto_sign_signature(sm, &siglen, m, (size_t)mlen, sk)) {
+        *smlen = 0;
+        return -1;
+    }
 
     memmove(sm + SPX_BYTES, m, mlen);
     *smlen = siglen + mlen;
@@ -0,0 +1,491 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "api.h"
+#include "params.h"
+#include "context.h"
+#include "hash.h"
+#include "prf.h"
+#include "merkle.h"
+#include "signer.h"
+
+/*
+ * This is the signer object, which holds the private key and the caches of
+ * upper hypertree layers, and runs the background worker that fills them
+ */
+
+/* One cached Merkle tree */
+struct tree_entry {
+    uint32_t layer;
+    uint64_t tree;
+    unsigned char *nodes;       /* All the nodes of the tree, bottom up; */
+                                /* 0 if this slot is empty */
+    unsigned char *wots_sigs;   /* The WOTS signatures of each leaf (only */
+                                /* for layers > 0) */
+    unsigned char *sig_valid;   /* Which of the above we have */
+};
+
+/*
+ * The most trees a signer may be asked to cache; far more than would fit in
+ * memory, but it keeps the hash table size well clear of overflow
+ */
+#define MAX_CACHED_TREES (1u << 24)
+
+/*
+ * One memoized Merkle PRF key; the memo has KEY_MEMO_SLOTS of these (direct
+ * mapped by tree index) for each layer below the top
+ */
+#define KEY_MEMO_SLOTS 16
+
+struct key_memo {
+    uint64_t tree;
+    int valid;
+    unsigned char key[3*SPX_N];
+};
+
+struct spx_signer {
+    unsigned char sk[SPX_SK_BYTES];
+
+    pthread_mutex_t lock;       /* Protects everything below */
+    pthread_cond_t idle;        /* Signalled when active drops to 0, or */
+                                /* when we're asked to stop */
+    unsigned active;            /* Number of signing requests in flight */
+    int stop;                   /* Set to ask the worker to exit */
+    int worker_running;
+    pthread_t worker;
+
+    unsigned max_trees;         /* The most trees we'll cache */
+    unsigned num_trees;         /* How many we have */
+    unsigned num_slots;         /* Size of the hash table (a power of 2) */
+    struct tree_entry *slots;
+
+    struct key_memo *memo;      /* The Merkle PRF keys we've derived, in */
+                                /* locked memory; 0 if we couldn't lock it */
+    size_t memo_size;
+};
+
+/*
+ * Find the slot for (layer, tree); this returns either the slot holding
+ * that tree, or the empty slot where it would go
+ * This assumes the lock is held
+ */
+static struct tree_entry *find_slot(struct spx_signer *s,
+                                    uint32_t layer, uint64_t tree)
+{
+    uint64_t hash = (tree + layer) * 0x9e3779b97f4a7c15ULL;
+    unsigned i = (unsigned)(hash >> 32) & (s->num_slots - 1);
+
+    /* We keep the table at most half full, so this always terminates */
+    for (;; i = (i + 1) & (s->num_slots - 1)) {
+        struct tree_entry *e = &s->slots[i];
+        if (!e->nodes || (e->layer == layer && e->tree == tree)) {
+            return e;
+        }
+    }
+}
+
+/*
+ * Return the offset (in nodes) of the node at height 'height' and index
+ * 'index' within the node table
+ */
+static unsigned node_offset(unsigned height, uint32_t index)
+{
+    return (2U << SPX_TREE_HEIGHT) - (2U << (SPX_TREE_HEIGHT - height)) +
+           index;
+}
+
+int spx_signer_lookup(struct spx_signer *s,
+                      uint32_t layer, uint64_t tree, uint32_t idx_leaf,
+                      unsigned char *wots_sig, unsigned char *auth_path,
+                      unsigned char *root)
+{
+    int result = SPX_CACHE_MISS;
+    unsigned h;
+
+    pthread_mutex_lock(&s->lock);
+    struct tree_entry *e = find_slot(s, layer, tree);
+    if (e->nodes) {
+        for (h = 0; h < SPX_TREE_HEIGHT; h++) {
+            memcpy(auth_path + h * SPX_N,
+                   e->nodes + node_offset(h, (idx_leaf >> h) ^ 1) * SPX_N,
+                   SPX_N);
+        }
+        memcpy(root, e->nodes + (SPX_MERKLE_NODES - 1) * SPX_N, SPX_N);
+        result = SPX_CACHE_TREE;
+
+        if (e->wots_sigs && e->sig_valid[idx_leaf]) {
+            memcpy(wots_sig, e->wots_sigs + idx_leaf * SPX_WOTS_BYTES,
+                   SPX_WOTS_BYTES);
+            result = SPX_CACHE_SIG;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return result;
+}
+
+void spx_signer_store_wots(struct spx_signer *s,
+                      uint32_t layer, uint64_t tree, uint32_t idx_leaf,
+                      const unsigned char *wots_sig)
+{
+    pthread_mutex_lock(&s->lock);
+    struct tree_entry *e = find_slot(s, layer, tree);
+    if (e->nodes && e->wots_sigs) {
+        memcpy(e->wots_sigs + idx_leaf * SPX_WOTS_BYTES, wots_sig,
+               SPX_WOTS_BYTES);
+        e->sig_valid[idx_leaf] = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static struct key_memo *memo_slot(struct spx_signer *s, int layer,
+                                  uint64_t tree)
+{
+    return &s->memo[(unsigned)layer * KEY_MEMO_SLOTS +
+                     (tree & (KEY_MEMO_SLOTS - 1))];
+}
+
+void spx_signer_prf_keys(struct spx_signer *s, uint64_t tree,
+                         uint32_t idx_leaf, spx_ctx *ctx)
+{
+    int level, known;
+
+    if (!s->memo) {
+        initialize_prf_key(tree, idx_leaf, ctx);
+        return;
+    }
+
+    memcpy(ctx->merkle_key[SPX_D-1], ctx->sk_seed, 3*SPX_N);
+
+    /* Copy out the keys we have, top down, until we hit one we don't */
+    pthread_mutex_lock(&s->lock);
+    for (level = SPX_D - 2; level >= 0; level--) {
+        uint64_t level_tree = tree >> (level * SPX_TREE_HEIGHT);
+        struct key_memo *e = memo_slot(s, level, level_tree);
+        if (!e->valid || e->tree != level_tree) {
+            break;
+        }
+        memcpy(ctx->merkle_key[level], e->key, 3*SPX_N);
+    }
+    pthread_mutex_unlock(&s->lock);
+    known = level + 1;
+
+    /* Derive the rest from the deepest one we have */
+    initialize_prf_key_from(tree, idx_leaf, ctx, known);
+
+    /* And remember the ones we derived */
+    if (known > 0) {
+        pthread_mutex_lock(&s->lock);
+        for (level = known - 1; level >= 0; level--) {
+            uint64_t level_tree = tree >> (level * SPX_TREE_HEIGHT);
+            struct key_memo *e = memo_slot(s, level, level_tree);
+            e->tree = level_tree;
+            e->valid = 1;
+            memcpy(e->key, ctx->merkle_key[level], 3*SPX_N);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/*
+ * Set up a context with the keys needed for the tree at (layer, tree)
+ */
+static void set_up_ctx(spx_ctx *ctx, struct spx_signer *s,
+                       uint32_t layer, uint64_t tree)
+{
+    memcpy(ctx->sk_seed, s->sk, 3*SPX_N);
+    memcpy(ctx->pub_seed, s->sk + 4*SPX_N, SPX_N);
+    ctx->cancel = 0;
+    ctx->prf_pipeline = 0;
+    initialize_hash_function(ctx);
+
+    /* spx_signer_prf_keys wants the index of the bottom tree; any tree */
+    /* below the one we want will do */
+    if (layer == SPX_D - 1) {
+        tree = 0;
+    } else {
+        tree <<= layer * SPX_TREE_HEIGHT;
+    }
+    spx_signer_prf_keys(s, tree, 0, ctx);
+}
+
+/*
+ * The worker calls this before every leaf; this waits until there are no
+ * signing requests in progress.  Returns nonzero if we've been asked to stop
+ */
+static int warm_pause(void *arg)
+{
+    struct spx_signer *s = arg;
+    int stop;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->active && !s->stop) {
+        pthread_cond_wait(&s->idle, &s->lock);
+    }
+    stop = s->stop;
+    pthread_mutex_unlock(&s->lock);
+
+    return stop;
+}
+
+/*
+ * Compute and insert the tree at (layer, tree), and (if we have its parent)
+ * the WOTS signature of its root.  Returns nonzero if we should stop
+ */
+static int warm_tree(struct spx_signer *s, uint32_t layer, uint64_t tree)
+{
+    spx_ctx ctx;
+    unsigned char *nodes = 0, *wots_sigs = 0, *sig_valid = 0;
+    const unsigned char *root;
+    unsigned char wots_sig[SPX_WOTS_BYTES];
+    unsigned char auth_path[SPX_TREE_HEIGHT * SPX_N];
+    unsigned char parent_root[SPX_N];
+    uint64_t parent_tree = tree >> SPX_TREE_HEIGHT;
+    uint32_t parent_leaf = (uint32_t)(tree & ((1 << SPX_TREE_HEIGHT) - 1));
+    int stop = 0;
+
+    nodes = malloc(SPX_MERKLE_NODES * SPX_N);
+    if (layer > 0) {
+        wots_sigs = malloc((1 << SPX_TREE_HEIGHT) * SPX_WOTS_BYTES);
+        sig_valid = calloc(1 << SPX_TREE_HEIGHT, 1);
+    }
+    if (!nodes || (layer > 0 && (!wots_sigs || !sig_valid))) {
+        stop = 1;
+        goto done;
+    }
+
+    set_up_ctx(&ctx, s, layer, tree);
+    if (merkle_gen_nodes(nodes, &ctx, layer, tree, warm_pause, s)) {
+        stop = 1;
+        goto done;
+    }
+    root = nodes + (SPX_MERKLE_NODES - 1) * SPX_N;
+
+    pthread_mutex_lock(&s->lock);
+    struct tree_entry *e = find_slot(s, layer, tree);
+    if (!e->nodes && s->num_trees < s->max_trees) {
+        e->layer = layer;
+        e->tree = tree;
+        e->nodes = nodes;
+        e->wots_sigs = wots_sigs;
+        e->sig_valid = sig_valid;
+        s->num_trees++;
+        nodes = wots_sigs = sig_valid = 0;  /* They're the cache's now */
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    /* Now, sign our root with the parent tree (if we have it) */
+    if (layer < SPX_D - 1 &&
+        spx_signer_lookup(s, layer + 1, parent_tree, parent_leaf,
+                          wots_sig, auth_path, parent_root) == SPX_CACHE_TREE) {
+        if (warm_pause(s)) {
+            stop = 1;
+        } else if (merkle_sign_wots(wots_sig, root, &ctx, layer + 1,
+                                    parent_tree, parent_leaf) == 0) {
+            spx_signer_store_wots(s, layer + 1, parent_tree, parent_leaf,
+                                  wots_sig);
+        }
+    }
+
+done:
+    memset(&ctx, 0, sizeof ctx);
+    free(nodes);
+    free(wots_sigs);
+    free(sig_valid);
+    return stop;
+}
+
+/*
+ * The background worker; this goes through the hypertree top down, and
+ * caches each tree in turn, until the cache is full
+ */
+static void *warm_worker(void *arg)
+{
+    struct spx_signer *s = arg;
+    int layer;
+
+    for (layer = SPX_D - 1; layer >= 0; layer--) {
+        unsigned shift = (unsigned)(SPX_D - 1 - layer) * SPX_TREE_HEIGHT;
+        uint64_t count, tree;
+
+        /* If the layer has more trees than we could possibly hold, we */
+        /* just go until the cache is full */
+        if (shift >= 32) {
+            count = (uint64_t)1 << 32;
+        } else {
+            count = (uint64_t)1 << shift;
+        }
+
+        for (tree = 0; tree < count; tree++) {
+            int full;
+            pthread_mutex_lock(&s->lock);
+            full = s->num_trees >= s->max_trees;
+            pthread_mutex_unlock(&s->lock);
+            if (full || warm_tree(s, (uint32_t)layer, tree)) {
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+struct spx_signer *spx_signer_create(const unsigned char *sk,
+                                     unsigned max_trees)
+{
+    struct spx_signer *s;
+
+    if (max_trees > MAX_CACHED_TREES) return 0;
+    s = calloc(1, sizeof *s);
+    if (!s) return 0;
+
+    memcpy(s->sk, sk, SPX_SK_BYTES);
+    s->max_trees = max_trees;
+    /* At least twice as many slots as trees */
+    for (s->num_slots = 1; s->num_slots / 2 < max_trees; s->num_slots *= 2)
+        ;
+    s->slots = calloc(s->num_slots, sizeof *s->slots);
+    if (!s->slots) {
+        free(s);
+        return 0;
+    }
+    pthread_mutex_init(&s->lock, 0);
+    pthread_cond_init(&s->idle, 0);
+
+    /* The memo holds secret keys; we only keep one if we can lock it in */
+    /* memory (so it won't be paged out) */
+    if (SPX_D > 1) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        void *memo;
+
+        s->memo_size = (SPX_D - 1) * KEY_MEMO_SLOTS * sizeof(struct key_memo);
+        s->memo_size = (s->memo_size + page - 1) & ~(page - 1);
+        if (posix_memalign(&memo, page, s->memo_size) == 0) {
+            if (mlock(memo, s->memo_size) == 0) {
+                memset(memo, 0, s->memo_size);
+                s->memo = memo;
+            } else {
+                free(memo);
+            }
+        }
+    }
+
+    return s;
+}
+
+int spx_signer_start_warming(struct spx_signer *s)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (!s->worker_running) {
+        s->stop = 0;
+        if (pthread_create(&s->worker, 0, warm_worker, s) == 0) {
+            s->worker_running = 1;
+        } else {
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+void spx_signer_stop_warming(struct spx_signer *s)
+{
+    int running;
+
+    pthread_mutex_lock(&s->lock);
+    running = s->worker_running;
+    s->stop = 1;
+    s->worker_running = 0;
+    pthread_cond_broadcast(&s->idle);
+    pthread_mutex_unlock(&s->lock);
+
+    if (running) {
+        pthread_join(s->worker, 0);
+    }
+}
+
+unsigned spx_signer_cached_trees(struct spx_signer *s)
+{
+    unsigned n;
+
+    pthread_mutex_lock(&s->lock);
+    n = s->num_trees;
+    pthread_mutex_unlock(&s->lock);
+
+    return n;
+}
+
+int spx_signer_sign(struct spx_signer *s,
+                    uint8_t *sig, size_t *siglen,
+                    const uint8_t *m, size_t mlen)
+{
+    struct spx_prepared prepared;
+
+    spx_sign_prepare(&prepared, m, mlen, s->sk);
+    return spx_signer_complete(s, sig, siglen, &prepared);
+}
+
+int spx_signer_complete(struct spx_signer *s,
+                        uint8_t *sig, size_t *siglen,
+                        const struct spx_prepared *prepared)
+{
+    return spx_signer_complete_cancellable(s, sig, siglen, prepared, 0);
+}
+
+int spx_signer_complete_cancellable(struct spx_signer *s,
+                                    uint8_t *sig, size_t *siglen,
+                                    const struct spx_prepared *prepared,
+                                    const int *cancel)
+{
+    int ret;
+
+    /* Tell the worker to step aside while we're signing */
+    pthread_mutex_lock(&s->lock);
+    s->active++;
+    pthread_mutex_unlock(&s->lock);
+
+    ret = spx_sign_internal(sig, siglen, prepared, s->sk, s, cancel);
+
+    pthread_mutex_lock(&s->lock);
+    if (--s->active == 0) {
+        pthread_cond_broadcast(&s->idle);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+void spx_signer_destroy(struct spx_signer *s)
+{
+    unsigned i;
+
+    if (!s) return;
+
+    spx_signer_stop_warming(s);
+
+    for (i = 0; i < s->num_slots; i++) {
+        free(s->slots[i].nodes);
+        free(s->slots[i].wots_sigs);
+        free(s->slots[i].sig_valid);
+    }
+    free(s->slots);
+    if (s->memo) {
+        memset(s->memo, 0, s->memo_size);
+        munlock(s->memo, s->memo_size);
+        free(s->memo);
+    }
+    pthread_cond_destroy(&s->idle);
+    pthread_mutex_destroy(&s->lock);
+
+    memset(s->sk, 0, SPX_SK_BYTES);
+    free(s);
+}
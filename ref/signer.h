@@ -0,0 +1,181 @@
+#if !defined( SIGNER_H_ )
+#define SIGNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "params.h"
+#include "context.h"
+
+/*
+ * A signer is a long lived object that holds a private key, along with
+ * caches of the parts of the upper hypertree layers.  Those layers have
+ * only a small number of possible trees (1 at the top, 2^h below that, and
+ * so on), and (unlike the bottom layer, which signs a FORS public key) the
+ * Merkle signatures they produce do not depend on the message.  Hence we can
+ * compute those once, and reuse them for every signature that goes through
+ * that part of the hypertree.
+ *
+ * For each cached tree, we keep its full node table (so the authentication
+ * path and root for any leaf is a memcpy), and the WOTS signatures for those
+ * leaves for which we know the message (the root of the tree below).
+ *
+ * The caches can be warmed by a background thread, which uses idle CPU to
+ * populate them, most useful layers first.  It steps aside (at the next
+ * Merkle leaf boundary) whenever a signing request is in progress.
+ */
+struct spx_signer;
+
+/*
+ * Create a signer for the private key sk, which will cache (at most)
+ * max_trees Merkle trees.  Returns 0 on failure (including if max_trees is
+ * unreasonably large, over 2^24)
+ */
+struct spx_signer *spx_signer_create(const unsigned char *sk,
+                                     unsigned max_trees);
+
+/*
+ * Stop the background worker (if running), wipe the private key and free
+ * everything
+ */
+void spx_signer_destroy(struct spx_signer *signer);
+
+/*
+ * Start the background worker, which populates the caches until they're
+ * full.  Returns 0 on success, -1 on failure
+ */
+int spx_signer_start_warming(struct spx_signer *signer);
+
+/*
+ * Stop the background worker (and wait for it to exit)
+ */
+void spx_signer_stop_warming(struct spx_signer *signer);
+
+/*
+ * Returns the number of Merkle trees currently in the cache
+ */
+unsigned spx_signer_cached_trees(struct spx_signer *signer);
+
+/*
+ * Generate a detached signature, using (and adding to) the caches
+ * Returns 0 on success, -1 if a fault was detected
+ */
+int spx_signer_sign(struct spx_signer *signer,
+                    uint8_t *sig, size_t *siglen,
+                    const uint8_t *m, size_t mlen);
+
+/*
+ * Signing can also be split in two phases.  The first (spx_sign_prepare)
+ * is cheap; it hashes the message, and so learns which hypertree path
+ * (tree and leaf) the signature will use.  The second (spx_sign_complete,
+ * or spx_signer_complete) does all the hypertree work.  This allows a
+ * front end to route the second phase to a signer whose caches already
+ * hold that path.
+ *
+ * The prepared structure holds no secrets, but it must come from someone
+ * trusted with the private key: completing a prepared message with a
+ * chosen mhash reveals FORS secrets of the attacker's choosing
+ */
+struct spx_prepared {
+    uint8_t R[SPX_N];                   /* The randomizer */
+    uint8_t mhash[SPX_FORS_MSG_BYTES];  /* What FORS signs */
+    uint64_t tree;                      /* The bottom Merkle tree */
+    uint32_t idx_leaf;                  /* The leaf within that tree */
+};
+
+/*
+ * Run the first phase of signing m.  Returns 0
+ */
+int spx_sign_prepare(struct spx_prepared *prepared,
+                     const uint8_t *m, size_t mlen, const uint8_t *sk);
+
+/*
+ * Run the second phase, generating the detached signature.  Returns 0 on
+ * success, -1 on failure (as crypto_sign_signature, or if prepared does not
+ * describe a valid path)
+ */
+int spx_sign_complete(uint8_t *sig, size_t *siglen,
+                      const struct spx_prepared *prepared, const uint8_t *sk);
+
+/*
+ * Run the second phase with a signer (which holds the private key), using
+ * (and adding to) its caches
+ */
+int spx_signer_complete(struct spx_signer *signer,
+                        uint8_t *sig, size_t *siglen,
+                        const struct spx_prepared *prepared);
+
+/*
+ * Abandoning a request.  The _cancellable versions take a cancellation
+ * token, an int that another thread may set to nonzero (once it no longer
+ * wants the result).  The token is checked at each hypertree layer, each
+ * FORS tree, each Merkle leaf and each WOTS chain, so the work stops within
+ * one chain (SPX_WOTS_W - 1 masked F calls) of it being set; with
+ * SPX_F_COALESCE, where a leaf's chains are walked together, within one
+ * leaf.  A cancelled call wipes what it
+ * has computed (including any partial signature or key) and returns
+ * SPX_CANCELLED (-2); a token that is never set changes nothing
+ */
+int spx_sign_complete_cancellable(uint8_t *sig, size_t *siglen,
+                                  const struct spx_prepared *prepared,
+                                  const uint8_t *sk, const int *cancel);
+
+int spx_signer_complete_cancellable(struct spx_signer *signer,
+                                    uint8_t *sig, size_t *siglen,
+                                    const struct spx_prepared *prepared,
+                                    const int *cancel);
+
+int spx_seed_keypair_cancellable(unsigned char *pk, unsigned char *sk,
+                                 const unsigned char *seed,
+                                 const int *cancel);
+
+/*
+ * The rest of this is the interface between the signer and the signing
+ * logic in sign.c
+ */
+
+/* The results of spx_signer_lookup */
+#define SPX_CACHE_MISS 0  /* We don't have this tree */
+#define SPX_CACHE_TREE 1  /* We have the tree, but not the WOTS signature */
+#define SPX_CACHE_SIG  2  /* We have both */
+
+/*
+ * Look up the Merkle tree at (layer, tree).  If it is present, this writes
+ * the authentication path for idx_leaf, and the root of the tree.  If the
+ * WOTS signature for idx_leaf is also present, this writes that too.
+ */
+#define spx_signer_lookup SPX_NAMESPACE(spx_signer_lookup)
+int spx_signer_lookup(struct spx_signer *signer,
+                      uint32_t layer, uint64_t tree, uint32_t idx_leaf,
+                      unsigned char *wots_sig, unsigned char *auth_path,
+                      unsigned char *root);
+
+/*
+ * Record the WOTS signature for idx_leaf of a cached tree
+ */
+#define spx_signer_store_wots SPX_NAMESPACE(spx_signer_store_wots)
+void spx_signer_store_wots(struct spx_signer *signer,
+                      uint32_t layer, uint64_t tree, uint32_t idx_leaf,
+                      const unsigned char *wots_sig);
+
+/*
+ * Set up the Merkle PRF keys (and FORS seed) in ctx for the signature at
+ * (tree, idx_leaf), as initialize_prf_key does.  The signer remembers the
+ * Merkle keys it has derived (in memory it has locked, if it could), so
+ * this only needs to derive the ones below the deepest tree it has seen
+ */
+#define spx_signer_prf_keys SPX_NAMESPACE(spx_signer_prf_keys)
+void spx_signer_prf_keys(struct spx_signer *signer, uint64_t tree,
+                         uint32_t idx_leaf, spx_ctx *ctx);
+
+/*
+ * Generate a detached signature for a prepared message, consulting the
+ * caches in signer (if nonzero), and giving up if *cancel (if nonzero) is
+ * set.  This is what crypto_sign_signature is built on
+ */
+#define spx_sign_internal SPX_NAMESPACE(spx_sign_internal)
+int spx_sign_internal(uint8_t *sig, size_t *siglen,
+                      const struct spx_prepared *prepared, const uint8_t *sk,
+                      struct spx_signer *signer, const int *cancel);
+
+#endif /* SIGNER_H_ */
@@ -0,0 +1,299 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "api.h"
+#include "params.h"
+#include "context.h"
+#include "hash.h"
+#include "address.h"
+#include "fors.h"
+#include "wots.h"
+#include "fips202.h"
+#include "f-plain.h"
+#include "f-threshold.h"
+#include "streamverify.h"
+
+/*
+ * The signature is a sequence of N-byte pieces; these are where they are
+ */
+#define FORS_PIECES (SPX_FORS_TREES * (SPX_FORS_HEIGHT + 1))
+#define LAYER_PIECES (SPX_WOTS_LEN + SPX_TREE_HEIGHT)
+#define TOTAL_PIECES (1 + FORS_PIECES + SPX_D * LAYER_PIECES)
+
+#if TOTAL_PIECES * SPX_N != SPX_BYTES
+#error The signature does not consist of the pieces we expect
+#endif
+
+struct spx_verify_stream {
+    spx_ctx ctx;
+    unsigned char pk[SPX_PK_BYTES];
+    const uint8_t *m;               /* Until we've hashed it */
+    size_t mlen;
+
+    unsigned char piece[SPX_N];     /* The partial piece we have so far */
+    unsigned piece_len;
+    uint32_t next_piece;            /* The index of that piece */
+    int failed;
+
+    uint32_t indices[SPX_FORS_TREES];
+    uint64_t tree;
+    uint32_t idx_leaf;
+    unsigned int lengths[SPX_WOTS_LEN];
+
+    /* The node we're working up from; at the end of each section, this is */
+    /* the root that the next section signs */
+    unsigned char node[SPX_N];
+
+    /* While we climb a tree, the SHAKE256 template (as in compute_root), */
+    /* which holds the node we're working up from in lane format */
+    uint64_t tree_state[25];
+
+    /* The public key (either FORS or WOTS) that we're hashing together */
+    uint64_t pk_state[26];
+
+    uint32_t fors_tree_addr[8];
+    uint32_t fors_pk_addr[8];
+    uint32_t wots_addr[8];
+    uint32_t wots_pk_addr[8];
+    uint32_t tree_addr[8];
+};
+
+/*
+ * Start hashing a public key together; this is thash, one block at a time
+ */
+static void start_pk(struct spx_verify_stream *s, const uint32_t addr[8])
+{
+    shake256_inc_init(s->pk_state);
+    shake256_inc_absorb(s->pk_state, s->ctx.pub_seed, SPX_N);
+    shake256_inc_absorb(s->pk_state, (const uint8_t *)addr, SPX_ADDR_BYTES);
+}
+
+static void finish_pk(struct spx_verify_stream *s)
+{
+    shake256_inc_finalize(s->pk_state);
+    shake256_inc_squeeze(s->node, SPX_N, s->pk_state);
+}
+
+/*
+ * Go up one level (to 'height') in a tree of height top, with the auth path
+ * node 'auth'; this is one iteration of compute_root, and like it, keeps
+ * the node in lane format in the template from one level to the next
+ */
+static void climb(struct spx_verify_stream *s, const unsigned char *auth,
+                  uint32_t height, uint32_t top,
+                  uint32_t leaf_idx, uint32_t idx_offset, uint32_t addr[8])
+{
+    uint64_t *left = &s->tree_state[PLAIN_VALUE_OFFSET];
+    uint64_t *right = &s->tree_state[PLAIN_VALUE_OFFSET + SPX_N/8];
+    uint32_t idx = leaf_idx >> (height - 1);
+
+    if (height == 1) {
+        /* A new tree; we're starting from the leaf in s->node */
+        set_up_plain_block(s->tree_state, &s->ctx, addr, 2);
+        transform_f((idx & 1) ? right : left, s->node, SPX_N);
+    }
+    /* The node is in place; the auth path node goes on the other side */
+    set_plain_value(s->tree_state, (idx & 1) ? 0 : 1, auth);
+
+    set_tree_height(addr, height);
+    set_tree_index(addr, (leaf_idx + idx_offset) >> height);
+    update_plain_tree_addr(s->tree_state, addr);
+
+    if (height == top) {
+        plain_hash(left, s->tree_state);
+        untransform_f(s->node, left);
+    } else {
+        /* Put the parent where it goes for the next level */
+        plain_hash(((idx >> 1) & 1) ? right : left, s->tree_state);
+    }
+}
+
+/*
+ * R: hash the message, which tells us the path and the FORS leaves
+ */
+static void process_r(struct spx_verify_stream *s, const unsigned char *r)
+{
+    unsigned char mhash[SPX_FORS_MSG_BYTES];
+
+    hash_message(mhash, &s->tree, &s->idx_leaf, r, s->pk, s->m, s->mlen,
+                 &s->ctx);
+    s->m = 0;
+    message_to_indices(s->indices, mhash);
+
+    /* Layer correctly defaults to 0, so no need to set_layer_addr */
+    set_tree_addr(s->wots_addr, s->tree);
+    set_keypair_addr(s->wots_addr, s->idx_leaf);
+    copy_keypair_addr(s->fors_tree_addr, s->wots_addr);
+    copy_keypair_addr(s->fors_pk_addr, s->wots_addr);
+
+    start_pk(s, s->fors_pk_addr);
+}
+
+/*
+ * One FORS piece: either the secret of tree i's leaf, or the j'th node of
+ * its auth path
+ */
+static void process_fors(struct spx_verify_stream *s,
+                         const unsigned char *piece, uint32_t i, uint32_t j)
+{
+    uint32_t idx_offset = i << SPX_FORS_HEIGHT;
+
+    if (j == 0) {
+        /* The leaf is F of the secret */
+        uint64_t state[25];
+
+        set_tree_height(s->fors_tree_addr, 0);
+        set_tree_index(s->fors_tree_addr, s->indices[i] + idx_offset);
+        set_up_plain_block(state, &s->ctx, s->fors_tree_addr, 1);
+        set_plain_value(state, 0, piece);
+        plain_hash(&state[PLAIN_VALUE_OFFSET], state);
+        untransform_f(s->node, &state[PLAIN_VALUE_OFFSET]);
+        return;
+    }
+
+    climb(s, piece, j, SPX_FORS_HEIGHT, s->indices[i], idx_offset,
+          s->fors_tree_addr);
+    if (j == SPX_FORS_HEIGHT) {
+        shake256_inc_absorb(s->pk_state, s->node, SPX_N);
+        if (i == SPX_FORS_TREES - 1) {
+            finish_pk(s);       /* The FORS public key */
+        }
+    }
+}
+
+/*
+ * One hypertree piece: either chain j of the WOTS signature in this layer,
+ * or a node of the auth path (if j >= SPX_WOTS_LEN)
+ */
+static void process_layer(struct spx_verify_stream *s,
+                          const unsigned char *piece,
+                          uint32_t layer, uint32_t j)
+{
+    unsigned char top[SPX_N];
+    uint32_t height;
+
+    if (j == 0) {
+        /* s->node is the root this layer signs */
+        set_layer_addr(s->tree_addr, layer);
+        set_tree_addr(s->tree_addr, s->tree);
+        copy_subtree_addr(s->wots_addr, s->tree_addr);
+        set_keypair_addr(s->wots_addr, s->idx_leaf);
+        copy_keypair_addr(s->wots_pk_addr, s->wots_addr);
+
+        chain_lengths(s->lengths, s->node);
+        start_pk(s, s->wots_pk_addr);
+    }
+
+    if (j < SPX_WOTS_LEN) {
+        set_chain_addr(s->wots_addr, j);
+        wots_chain_from_sig(top, piece, s->lengths[j], &s->ctx, s->wots_addr);
+        shake256_inc_absorb(s->pk_state, top, SPX_N);
+        if (j == SPX_WOTS_LEN - 1) {
+            finish_pk(s);       /* The leaf of this layer's tree */
+        }
+        return;
+    }
+
+    height = j - SPX_WOTS_LEN + 1;
+    climb(s, piece, height, SPX_TREE_HEIGHT, s->idx_leaf, 0, s->tree_addr);
+    if (height == SPX_TREE_HEIGHT) {
+        /* Update the indices for the next layer. */
+        s->idx_leaf = (s->tree & ((1 << SPX_TREE_HEIGHT)-1));
+        s->tree = s->tree >> SPX_TREE_HEIGHT;
+    }
+}
+
+static void process_piece(struct spx_verify_stream *s,
+                          const unsigned char *piece)
+{
+    uint32_t n = s->next_piece++;
+
+    if (n == 0) {
+        process_r(s, piece);
+        return;
+    }
+    n -= 1;
+    if (n < FORS_PIECES) {
+        process_fors(s, piece, n / (SPX_FORS_HEIGHT + 1),
+                     n % (SPX_FORS_HEIGHT + 1));
+        return;
+    }
+    n -= FORS_PIECES;
+    process_layer(s, piece, n / LAYER_PIECES, n % LAYER_PIECES);
+}
+
+struct spx_verify_stream *spx_verify_stream_create(const uint8_t *m,
+                                                   size_t mlen,
+                                                   const uint8_t *pk)
+{
+    struct spx_verify_stream *s = calloc(1, sizeof *s);
+
+    if (!s) return 0;
+    memcpy(s->pk, pk, SPX_PK_BYTES);
+    memcpy(s->ctx.pub_seed, pk, SPX_N);
+    s->m = m;
+    s->mlen = mlen;
+
+    /* This hook allows the hash function instantiation to do whatever
+       preparation or computation it needs, based on the public seed. */
+    initialize_hash_function(&s->ctx);
+
+    set_type(s->wots_addr, SPX_ADDR_TYPE_WOTS);
+    set_type(s->wots_pk_addr, SPX_ADDR_TYPE_WOTSPK);
+    set_type(s->tree_addr, SPX_ADDR_TYPE_HASHTREE);
+    set_type(s->fors_tree_addr, SPX_ADDR_TYPE_FORSTREE);
+    set_type(s->fors_pk_addr, SPX_ADDR_TYPE_FORSPK);
+
+    return s;
+}
+
+int spx_verify_stream_update(struct spx_verify_stream *s,
+                             const uint8_t *sig, size_t len)
+{
+    size_t n;
+
+    while (len > 0) {
+        if (s->next_piece == TOTAL_PIECES) {
+            s->failed = 1;      /* More than a signature's worth */
+            return -1;
+        }
+
+        /* If we have a whole piece in the caller's buffer, use it there */
+        if (s->piece_len == 0 && len >= SPX_N) {
+            process_piece(s, sig);
+            sig += SPX_N;
+            len -= SPX_N;
+            continue;
+        }
+
+        n = SPX_N - s->piece_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(s->piece + s->piece_len, sig, n);
+        s->piece_len += (unsigned)n;
+        sig += n;
+        len -= n;
+        if (s->piece_len == SPX_N) {
+            process_piece(s, s->piece);
+            s->piece_len = 0;
+        }
+    }
+    return 0;
+}
+
+int spx_verify_stream_final(struct spx_verify_stream *s)
+{
+    /* Check if the root node equals the root node in the public key. */
+    if (s->failed || s->next_piece != TOTAL_PIECES || s->piece_len != 0 ||
+        memcmp(s->node, s->pk + SPX_N, SPX_N)) {
+        return -1;
+    }
+    return 0;
+}
+
+void spx_verify_stream_destroy(struct spx_verify_stream *s)
+{
+    free(s);
+}
@@ -0,0 +1,49 @@
+#if !defined( STREAMVERIFY_H_ )
+#define STREAMVERIFY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A stream verifier checks a detached signature as it arrives, rather than
+ * after all of it has been received.  The signature is hashed front to back
+ * (R, then the FORS trees, then the WOTS signature and authentication path
+ * of each layer), and each N-byte piece is processed as soon as it is
+ * complete; all we keep is the node we're working up from, the indices and
+ * a partially absorbed public key hash.  Hence, when the last byte arrives,
+ * all that is left to do is the last few hashes.
+ *
+ * Nothing about the signature can be trusted until spx_verify_stream_final
+ * has returned 0.
+ */
+struct spx_verify_stream;
+
+/*
+ * Start verifying a signature of the message m under the public key pk.
+ * Hashing the message is done when the first SPX_N bytes (R) arrive; m must
+ * remain valid until then.  Returns 0 on failure
+ */
+struct spx_verify_stream *spx_verify_stream_create(const uint8_t *m,
+                                                   size_t mlen,
+                                                   const uint8_t *pk);
+
+/*
+ * Pass the next len bytes of the signature.  Returns 0 on success, -1 if
+ * this runs past the end of a signature (after which the verification
+ * will fail)
+ */
+int spx_verify_stream_update(struct spx_verify_stream *stream,
+                             const uint8_t *sig, size_t len);
+
+/*
+ * Called after the entire signature has been passed.  Returns 0 if the
+ * signature is valid, -1 if not (including if it was too short or too long)
+ */
+int spx_verify_stream_final(struct spx_verify_stream *stream);
+
+/*
+ * Release the stream verifier
+ */
+void spx_verify_stream_destroy(struct spx_verify_stream *stream);
+
+#endif /* STREAMVERIFY_H_ */
@@ -3,8 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "../thash.h"
+#include "../hash.h"
 #include "../api.h"
 #include "../fors.h"
 #include "../wotsx1.h"
@@ -14,6 +16,7 @@
 
 #define SPX_MLEN 32
 #define NTESTS 10
+#define SIGN_THREADS 4      /* For the throughput measurement */
 
 static void wots_gen_pkx1(unsigned char *pk, const spx_ctx* ctx,
                 uint32_t addr[8]);
@@ -106,6 +109,51 @@ static void display_result(double result, unsigned long long *l, size_t llen, un
     1000);
 #define MEASURE(TEXT, MUL, FNCALL) MEASURE_GENERIC(TEXT, MUL, FNCALL, 1)
 
+/* Each thread of the throughput measurement signs NTESTS messages */
+static void *sign_messages(void *sk)
+{
+    unsigned char m[SPX_MLEN] = {0};
+    unsigned char *sig = malloc(SPX_BYTES);
+    size_t siglen;
+    int i;
+
+    for (i = 0; i < NTESTS; i++) {
+        m[0] = (unsigned char)i;
+        crypto_sign_signature(sig, &siglen, m, SPX_MLEN, sk);
+    }
+    free(sig);
+    return 0;
+}
+
+/*
+ * Signing throughput (signatures per second of wall clock time) with
+ * nthreads threads signing at once
+ */
+static void measure_throughput(const unsigned char *sk, int nthreads)
+{
+    pthread_t thread[SIGN_THREADS];
+    struct timespec start, stop;
+    double secs;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&thread[i], 0, sign_messages, (void *)sk)) {
+            printf("pthread_create failed\n");
+            nthreads = i;
+            break;
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(thread[i], 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    secs = (double)(stop.tv_sec - start.tv_sec) +
+           (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Signing, %d threads..  %8.2lf signatures/sec\n", nthreads,
+           (double)(nthreads * NTESTS) / secs);
+}
+
 int main(void)
 {
     /* Make stdout buffer more responsive. */
@@ -125,6 +173,7 @@ int main(void)
     unsigned char fors_sig[SPX_FORS_BYTES];
     unsigned char addr[SPX_ADDR_BYTES];
     unsigned char block[SPX_N];
+    unsigned char prf_node[3*SPX_N] = {0};
 
     unsigned char wots_pk[SPX_WOTS_PK_BYTES];
 
@@ -137,14 +186,19 @@ int main(void)
 
     randombytes(m, SPX_MLEN);
     randombytes(addr, SPX_ADDR_BYTES);
+    ctx.cancel = 0;
+    ctx.prf_pipeline = 0;
 
     printf("Parameters: n = %d, h = %d, d = %d, b = %d, k = %d, w = %d\n",
            SPX_N, SPX_FULL_HEIGHT, SPX_D, SPX_FORS_HEIGHT, SPX_FORS_TREES,
            SPX_WOTS_W);
 
+    printf("Key format %d\n", CRYPTO_KEYFORMAT);
+
     printf("Running %d iterations.\n", NTESTS);
 
     MEASURT("thash                ", 1, thash(block, block, 1, &ctx, (uint32_t*)addr));
+    MEASURT("PRF tree node        ", 1, prf_hash_function(prf_node, &ctx, (uint32_t*)addr, prf_node));
     MEASURE("Generating keypair.. ", 1, crypto_sign_keypair(pk, sk));
 #if 0
     MEASURE("  - WOTS pk gen..    ", (1 << SPX_TREE_HEIGHT), wots_gen_pkx1(wots_pk, &ctx, (uint32_t *) addr));
@@ -155,6 +209,8 @@ int main(void)
     MEASURE("  - WOTS pk gen..    ", SPX_D * (1 << SPX_TREE_HEIGHT), wots_gen_pkx1(wots_pk, &ctx, (uint32_t *) addr));
 #endif
     MEASURE("Verifying..          ", 1, crypto_sign_open(mout, &mlen, sm, smlen, pk));
+    measure_throughput(sk, 1);
+    measure_throughput(sk, SIGN_THREADS);
 
     printf("Signature size: %d (%.2f KiB)\n", SPX_BYTES, SPX_BYTES / 1024.0);
     printf("Public key size: %d (%.2f KiB)\n", SPX_PK_BYTES, SPX_PK_BYTES / 1024.0);
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../params.h"
+#include "../context.h"
+#include "../randombytes.h"
+#include "../address.h"
+#include "../fips202-threshold.h"
+#include "../f-threshold.h"
+#include "../f-coalesce.h"
+
+#define THREADS 3
+#define BATCHES 8
+/* Enough that a batch outlasts a time slice, so that the threads' */
+/* batches overlap (and they take each other's jobs) even on one core */
+#define JOBS 128
+
+/*
+ * Walk a job's chain one F at a time, as walk_wots_chain does; this is what
+ * coalesce_f_chains should agree with.  Writes the unblinded top value and
+ * (if there is one) the unblinded captured value
+ */
+static void walk_chain(unsigned char *top, unsigned char *capture,
+                       struct f_job *job)
+{
+    uint64_t *value = &job->chain_state[job->value_offset];
+    unsigned k;
+
+    for (k = 0;; k++) {
+        if (k == job->capture) {
+            if (k < job->steps) {
+                uint64_t shares[3*SPX_N/8];
+                memcpy(&shares[0], &value[0], SPX_N);
+                memcpy(&shares[SPX_N/8], &value[25], SPX_N);
+                memcpy(&shares[2*SPX_N/8], &value[50], SPX_N);
+                unmask_f_values(capture, shares, 1);
+            } else {
+                untransform_f(capture, value);
+            }
+        }
+        if (k == job->steps) break;
+        f_transform(job->chain_state, k + 1 != job->steps);
+        increment_hash_addr_in_chain_state(job->chain_state);
+    }
+    untransform_f(top, value);
+}
+
+struct thread_test {
+    spx_ctx ctx;
+    int fail;
+};
+
+/* Random jobs (some of them with no steps, some capturing the top) */
+static void random_job(struct f_job *job, uint64_t *captured,
+                       const spx_ctx *ctx, uint32_t chain)
+{
+    unsigned char prf[3*SPX_N];
+    uint32_t addr[8] = {0};
+    unsigned char r[2];
+
+    randombytes(prf, sizeof prf);
+    randombytes(r, sizeof r);
+    set_type(addr, SPX_ADDR_TYPE_WOTS);
+    set_chain_addr(addr, chain);
+    set_up_f_job(job, prf, r[0] % SPX_WOTS_W, r[1] % SPX_WOTS_W, captured,
+                 ctx, addr);
+}
+
+static void *run_batches(void *arg)
+{
+    struct thread_test *t = arg;
+    struct f_job jobs[JOBS], expect[JOBS];
+    uint64_t captured[JOBS][3*SPX_N/8];
+    unsigned char top[SPX_N], top_expect[SPX_N];
+    unsigned char cap[SPX_N], cap_expect[SPX_N];
+    int b, i;
+
+    for (b = 0; b < BATCHES; b++) {
+        /* Alternate between many jobs and just one (as FORS gives us) */
+        int count = (b & 1) ? 1 : JOBS;
+
+        for (i = 0; i < count; i++) {
+            random_job(&jobs[i], captured[i], &t->ctx, (uint32_t)i);
+            expect[i] = jobs[i];
+        }
+        coalesce_f_chains(jobs, (unsigned)count);
+        for (i = 0; i < count; i++) {
+            walk_chain(top_expect, cap_expect, &expect[i]);
+            untransform_f(top, &jobs[i].chain_state[jobs[i].value_offset]);
+            if (memcmp(top, top_expect, SPX_N)) {
+                t->fail = 1;
+            }
+            if (jobs[i].capture <= jobs[i].steps) {
+                unmask_f_values(cap, captured[i], 1);
+                if (memcmp(cap, cap_expect, SPX_N)) {
+                    t->fail = 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    uint64_t in[4][75], out[4][75], expect[75];
+    const uint64_t *inp[4];
+    uint64_t *outp[4];
+    struct thread_test t[THREADS];
+    pthread_t thread[THREADS];
+    int ret = 0;
+    int i, lane, threshold;
+
+    /* Make stdout buffer more responsive. */
+    setbuf(stdout, NULL);
+
+    printf("Testing the x4 threshold permutation.. ");
+    for (i = 0; i < 10; i++) {
+        randombytes((unsigned char *)in, sizeof in);
+        for (lane = 0; lane < 4; lane++) {
+            inp[lane] = in[lane];
+            outp[lane] = out[lane];
+        }
+        for (threshold = 0; threshold < 2; threshold++) {
+            do_threshold_keccak_permutationx4(inp, outp, threshold);
+            for (lane = 0; lane < 4; lane++) {
+                do_threshold_keccak_permutation(in[lane], expect, threshold);
+                if (memcmp(out[lane], expect, 4*8) ||
+                    (threshold &&
+                     (memcmp(&out[lane][25], &expect[25], 4*8) ||
+                      memcmp(&out[lane][50], &expect[50], 4*8)))) {
+                    ret = -1;
+                }
+            }
+        }
+    }
+    printf(ret ? "failed!\n" : "successful.\n");
+
+    printf("Testing F chains from %d threads.. ", THREADS);
+    for (i = 0; i < THREADS; i++) {
+        randombytes(t[i].ctx.pub_seed, SPX_N);
+        t[i].fail = 0;
+        if (pthread_create(&thread[i], 0, run_batches, &t[i])) {
+            printf("pthread_create failed!\n");
+            return -1;
+        }
+    }
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(thread[i], 0);
+        if (t[i].fail) {
+            ret = -1;
+        }
+    }
+    printf(ret ? "failed!\n" : "successful.\n");
+
+    return ret;
+}
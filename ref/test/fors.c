@@ -20,6 +20,8 @@ int main(void)
     unsigned char m[SPX_FORS_MSG_BYTES];
     uint32_t addr[8] = {0};
 
+    ctx.cancel = 0;
+    ctx.prf_pipeline = 0;
     randombytes(ctx.sk_seed, SPX_N);
     randombytes(ctx.pub_seed, SPX_N);
     randombytes(m, SPX_FORS_MSG_BYTES);
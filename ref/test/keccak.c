@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../fips202.h"
+
+/*
+ * Known answer tests for the (unmasked) Keccak based functions.  These use
+ * whichever permutation was compiled in (the vectorized one if built with
+ * AVX-512)
+ */
+
+/* Returns the test pattern (0x00, 0x01, ..., 0xfa, 0x00, ...) */
+static void pattern(unsigned char *buf, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        buf[i] = (unsigned char)(i % 251);
+    }
+}
+
+static int hex_equal(const unsigned char *buf, const char *hex, size_t len)
+{
+    char tmp[3];
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        snprintf(tmp, sizeof tmp, "%02x", buf[i]);
+        if (memcmp(tmp, hex + 2*i, 2)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * SHAKE256 of the pattern, 32 bytes of output.  shake128() is not checked
+ * against standard vectors: it absorbs at the SHAKE256 rate, and the PRF
+ * tree of key format 1 depends on that
+ */
+static const struct {
+    size_t msg_len;
+    const char *expected;
+} shake_kat[] = {
+    { 0,
+      "46b9dd2b0ba88d13233b3feb743eeb243fcd52ea62b81b82b50c27646ed5762f" },
+    { 135,
+      "c45dae624ad8a2f5aa7bac9d7557737fd91c96eedb70a6be5574d57a844eade0" },
+    { 136,
+      "b7ff4073b3f5a8eabd6e17705ca7f6761a31058f9df781a6a47e3a3063b9d67a" },
+    { 200,
+      "4ee1ca03272b05d3bfb1e1c79a967f823b9fc5e4bb3987b1ba9e9cb5afb07a5e" },
+};
+
+/*
+ * TurboSHAKE128 (the first two are from RFC 9861; the rest exercise the
+ * domain byte, and inputs and outputs that cross a block boundary)
+ */
+static const struct {
+    size_t msg_len;
+    int ff;                 /* Message is all 0xff, rather than the pattern */
+    unsigned char domain;
+    size_t skip;            /* Only check the output from here on */
+    const char *expected;   /* 32 bytes */
+} kat[] = {
+    { 0, 0, 0x1f, 0,
+      "1e415f1c5983aff2169217277d17bb538cd945a397ddec541f1ce41af2c1b74c" },
+    { 1, 0, 0x1f, 0,
+      "55cedd6f60af7bb29a4042ae832ef3f58db7299f893ebb9247247d856958daa9" },
+    { 0, 0, 0x1f, 32,
+      "3e8ccae2a4dae56c84a04c2385c03c15e8193bdf58737363321691c05462c8df" },
+    { 0, 0, 0x1f, 10000,
+      "a3b9b0385900ce761f22aed548e754da10a5242d62e8c658e3f3a923a7555607" },
+    { 17, 0, 0x1f, 0,
+      "9c97d036a3bac819db70ede0ca554ec6e4c2a1a4ffbfd9ec269ca6a111161233" },
+    { 289, 0, 0x1f, 0,
+      "96c77c279e0126f7fc07c9b07f5cdae1e0be60bdbe10620040e75d7223a624d2" },
+    { 4913, 0, 0x1f, 0,
+      "d4976eb56bcf118520582b709f73e1d6853e001fdaf80e1b13e0d0599d5fb372" },
+    { 1, 1, 0x01, 0,
+      "012ad664922ce3f81b058735b50aacbde383f1a9a75180b4b9f929550a5552b5" },
+    { 3, 1, 0x06, 0,
+      "3d03988bb59e681851a192f429ae03988e8f444bc06036a3f1a7d2ccd758d174" },
+    { 7, 1, 0x0b, 0,
+      "8deeaa1aec47ccee569f659c21dfa8e112db3cee37b18178b2acd805b799cc37" },
+    { 3, 1, 0x7f, 0,
+      "16274cc656d44cefd422395d0f9053bda6d28e122aba15c765e5ad0e6eaf26f9" },
+};
+
+int main(void)
+{
+    static unsigned char msg[4913];
+    static unsigned char out[10032];
+    unsigned i;
+    int ret = 0;
+
+    printf("Testing SHAKE256.. ");
+
+    for (i = 0; i < sizeof shake_kat / sizeof *shake_kat; i++) {
+        pattern(msg, shake_kat[i].msg_len);
+        shake256(out, 32, msg, shake_kat[i].msg_len);
+        if (!hex_equal(out, shake_kat[i].expected, 32)) {
+            printf("\n  X SHAKE256 test vector %u failed!", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        printf("successful.\n");
+    } else {
+        printf("\n");
+    }
+
+    printf("Testing TurboSHAKE128.. ");
+
+    for (i = 0; i < sizeof kat / sizeof *kat; i++) {
+        if (kat[i].ff) {
+            memset(msg, 0xff, kat[i].msg_len);
+        } else {
+            pattern(msg, kat[i].msg_len);
+        }
+        turboshake128(out, kat[i].skip + 32, msg, kat[i].msg_len,
+                      kat[i].domain);
+        if (!hex_equal(out + kat[i].skip, kat[i].expected, 32)) {
+            printf("\n  X TurboSHAKE128 test vector %u failed!", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        printf("successful.\n");
+    } else {
+        printf("\n");
+    }
+    return ret;
+}
@@ -0,0 +1,218 @@
+#define _POSIX_C_SOURCE 199309L
+
+/*
+ * This compares this implementation against the SLH-DSA implementation in
+ * OpenSSL (if the available OpenSSL has one) for the parameter set we were
+ * compiled with; make benchmark-openssl builds and runs it once for every
+ * parameter set.  It checks that OpenSSL accepts our signatures and that we
+ * accept OpenSSL's, and reports the relative sign and verify throughput
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <openssl/opensslv.h>
+
+#include "../api.h"
+#include "../params.h"
+#include "../randombytes.h"
+
+#define SPX_MLEN 32
+#define NTESTS 10
+
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+
+/* The 's' parameter sets have few layers, the 'f' sets have many */
+#define SPX_VARIANT (SPX_D <= 8 ? 's' : 'f')
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+/*
+ * Our signatures are over the message itself (the SLH-DSA 'internal'
+ * interface), so tell OpenSSL not to prepend the domain separator and
+ * context string
+ */
+static int init_message(EVP_PKEY *key, EVP_SIGNATURE *alg, int sign,
+                        EVP_PKEY_CTX **ctx)
+{
+    int encoding = 0;
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_int(OSSL_SIGNATURE_PARAM_MESSAGE_ENCODING, &encoding),
+        OSSL_PARAM_END
+    };
+
+    *ctx = EVP_PKEY_CTX_new_from_pkey(NULL, key, NULL);
+    if (!*ctx) return -1;
+    if (sign) {
+        return EVP_PKEY_sign_message_init(*ctx, alg, params) == 1 ? 0 : -1;
+    } else {
+        return EVP_PKEY_verify_message_init(*ctx, alg, params) == 1 ? 0 : -1;
+    }
+}
+
+static int ossl_sign(EVP_PKEY *key, EVP_SIGNATURE *alg, unsigned char *sig,
+                     const unsigned char *m, size_t mlen)
+{
+    EVP_PKEY_CTX *ctx;
+    size_t siglen = SPX_BYTES;
+    int ret = -1;
+
+    if (init_message(key, alg, 1, &ctx) == 0 &&
+        EVP_PKEY_sign(ctx, sig, &siglen, m, mlen) == 1 &&
+        siglen == SPX_BYTES) {
+        ret = 0;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    return ret;
+}
+
+static int ossl_verify(EVP_PKEY *key, EVP_SIGNATURE *alg,
+                       const unsigned char *sig,
+                       const unsigned char *m, size_t mlen)
+{
+    EVP_PKEY_CTX *ctx;
+    int ret = -1;
+
+    if (init_message(key, alg, 0, &ctx) == 0 &&
+        EVP_PKEY_verify(ctx, sig, SPX_BYTES, m, mlen) == 1) {
+        ret = 0;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    return ret;
+}
+
+static void report(const char *what, double ours, double theirs)
+{
+    printf("%-8s ours %10.2f/s   OpenSSL %10.2f/s   ratio %5.2fx\n",
+           what, NTESTS / ours, NTESTS / theirs, ours / theirs);
+}
+
+int main(void)
+{
+    char name[32];
+    unsigned char pk[SPX_PK_BYTES];
+    unsigned char sk[SPX_SK_BYTES];
+    unsigned char ossl_pk[SPX_PK_BYTES];
+    unsigned char m[SPX_MLEN];
+    unsigned char *sig = malloc(SPX_BYTES);
+    unsigned char *ossl_sig = malloc(SPX_BYTES);
+    size_t siglen;
+    EVP_PKEY *ossl_key = NULL, *our_key = NULL;
+    EVP_PKEY_CTX *kctx = NULL;
+    EVP_SIGNATURE *alg = NULL;
+    double start, ours_sign, ours_verify, ossl_sign_time, ossl_verify_time;
+    int ret = 0;
+    int i;
+
+    setbuf(stdout, NULL);
+
+    snprintf(name, sizeof name, "SLH-DSA-SHAKE-%d%c", 8 * SPX_N, SPX_VARIANT);
+    printf("Comparing against OpenSSL %s\n", name);
+
+    alg = EVP_SIGNATURE_fetch(NULL, name, NULL);
+    kctx = EVP_PKEY_CTX_new_from_name(NULL, name, NULL);
+    if (!alg || !kctx || EVP_PKEY_keygen_init(kctx) != 1 ||
+        EVP_PKEY_generate(kctx, &ossl_key) != 1) {
+        printf("OpenSSL does not support %s; skipping\n", name);
+        ERR_print_errors_fp(stdout);
+        goto done;
+    }
+
+    /* OpenSSL uses the same public key format as we do: PK.seed || root */
+    if (EVP_PKEY_get_octet_string_param(ossl_key, OSSL_PKEY_PARAM_PUB_KEY,
+                                        ossl_pk, sizeof ossl_pk, &siglen) != 1
+        || siglen != SPX_PK_BYTES) {
+        printf("X could not export the OpenSSL public key\n");
+        ret = -1;
+        goto done;
+    }
+
+    crypto_sign_keypair(pk, sk);
+    our_key = EVP_PKEY_new_raw_public_key_ex(NULL, name, NULL,
+                                             pk, SPX_PK_BYTES);
+    if (!our_key) {
+        printf("X OpenSSL could not import our public key\n");
+        ret = -1;
+        goto done;
+    }
+
+    randombytes(m, SPX_MLEN);
+
+    /* Check interoperability in both directions */
+    if (crypto_sign_signature(sig, &siglen, m, SPX_MLEN, sk) ||
+        ossl_verify(our_key, alg, sig, m, SPX_MLEN)) {
+        printf("X OpenSSL rejected our signature\n");
+        ret = -1;
+    } else {
+        printf("  OpenSSL accepts our signatures\n");
+    }
+    if (ossl_sign(ossl_key, alg, ossl_sig, m, SPX_MLEN) ||
+        crypto_sign_verify(ossl_sig, SPX_BYTES, m, SPX_MLEN, ossl_pk)) {
+        printf("X we rejected the OpenSSL signature\n");
+        ret = -1;
+    } else {
+        printf("  we accept OpenSSL signatures\n");
+    }
+
+    /* And compare the throughput */
+    start = now();
+    for (i = 0; i < NTESTS; i++) {
+        crypto_sign_signature(sig, &siglen, m, SPX_MLEN, sk);
+    }
+    ours_sign = now() - start;
+
+    start = now();
+    for (i = 0; i < NTESTS; i++) {
+        ossl_sign(ossl_key, alg, ossl_sig, m, SPX_MLEN);
+    }
+    ossl_sign_time = now() - start;
+
+    start = now();
+    for (i = 0; i < NTESTS; i++) {
+        crypto_sign_verify(sig, SPX_BYTES, m, SPX_MLEN, pk);
+    }
+    ours_verify = now() - start;
+
+    start = now();
+    for (i = 0; i < NTESTS; i++) {
+        ossl_verify(ossl_key, alg, ossl_sig, m, SPX_MLEN);
+    }
+    ossl_verify_time = now() - start;
+
+    printf("Running %d iterations (ratio is our time / OpenSSL time).\n",
+           NTESTS);
+    report("Signing", ours_sign, ossl_sign_time);
+    report("Verify", ours_verify, ossl_verify_time);
+
+done:
+    EVP_PKEY_CTX_free(kctx);
+    EVP_PKEY_free(ossl_key);
+    EVP_PKEY_free(our_key);
+    EVP_SIGNATURE_free(alg);
+    free(sig);
+    free(ossl_sig);
+
+    return ret;
+}
+
+#else
+
+int main(void)
+{
+    printf("%s does not provide SLH-DSA (3.5 or later is needed); "
+           "skipping\n", OPENSSL_VERSION_TEXT);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../api.h"
+#include "../params.h"
+#include "../randombytes.h"
+#include "../roottable.h"
+
+#define SPX_MLEN 32
+#define SPX_SIGNATURES 3
+#define TABLE_ENTRIES 256
+
+/* Longer than the table waits for a creator that hasn't locked the segment */
+#define SLOW_CREATOR_MS 1500
+
+/*
+ * A creator that is still alive, but takes its time: it holds the lock on
+ * the segment it created, and after a while checks that nobody replaced the
+ * segment under it, then gives up without setting it up
+ */
+struct slow_creator {
+    const char *name;
+    int fd;
+    int replaced;
+};
+
+static void *run_slow_creator(void *arg)
+{
+    struct slow_creator *c = arg;
+    struct timespec delay = { SLOW_CREATOR_MS / 1000,
+                              (SLOW_CREATOR_MS % 1000) * 1000000L };
+    struct stat ours, named;
+    int fd;
+
+    nanosleep(&delay, 0);
+    fd = shm_open(c->name, O_RDONLY, 0);
+    c->replaced = fd < 0 || fstat(fd, &named) || fstat(c->fd, &ours) ||
+                  named.st_ino != ours.st_ino;
+    if (fd >= 0) {
+        close(fd);
+    }
+    close(c->fd);
+    return 0;
+}
+
+/*
+ * Sign a few messages and check that they (and not tampered versions of
+ * them) verify through the table
+ */
+static int check_table(struct spx_root_table *table, const unsigned char *sk)
+{
+    unsigned char m[SPX_MLEN];
+    unsigned char *sig = malloc(SPX_BYTES);
+    size_t siglen;
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < SPX_SIGNATURES; i++) {
+        randombytes(m, SPX_MLEN);
+        crypto_sign_signature(sig, &siglen, m, SPX_MLEN, sk);
+
+        /* The first time learns the roots, the second uses them */
+        if (spx_root_table_verify(table, sig, siglen, m, SPX_MLEN) ||
+            spx_root_table_verify(table, sig, siglen, m, SPX_MLEN)) {
+            printf("  X signature %d failed!\n", i);
+            ret = -1;
+        }
+
+        /* Now that the table knows the roots, flip a bit in the top */
+        /* layer's authentication path; no root we compute below it */
+        /* changes, but the signature must still be rejected */
+        sig[SPX_BYTES - 1] ^= 1;
+        if (!spx_root_table_verify(table, sig, siglen, m, SPX_MLEN)) {
+            printf("  X signature %d with a tampered top layer verified!\n",
+                   i);
+            ret = -1;
+        }
+        sig[SPX_BYTES - 1] ^= 1;
+
+        /* Flip a bit in the FORS part; that changes every root we compute */
+        sig[SPX_N + 1] ^= 1;
+        if (!spx_root_table_verify(table, sig, siglen, m, SPX_MLEN)) {
+            printf("  X tampered signature %d verified!\n", i);
+            ret = -1;
+        }
+    }
+    free(sig);
+
+    return ret;
+}
+
+int main(void)
+{
+    int ret = 0;
+    char name[64];
+    int fd;
+
+    /* Make stdout buffer more responsive. */
+    setbuf(stdout, NULL);
+
+    unsigned char pk[SPX_PK_BYTES];
+    unsigned char sk[SPX_SK_BYTES];
+    unsigned char other_pk[SPX_PK_BYTES];
+    unsigned char other_sk[SPX_SK_BYTES];
+    struct spx_root_table *table, *table2;
+
+    printf("Generating keypairs.. ");
+    if (crypto_sign_keypair(pk, sk) ||
+        crypto_sign_keypair(other_pk, other_sk)) {
+        printf("failed!\n");
+        return -1;
+    }
+    printf("successful.\n");
+
+    printf("Testing a private table.. \n");
+    table = spx_root_table_create(pk, TABLE_ENTRIES);
+    if (!table || check_table(table, sk)) {
+        ret = -1;
+    }
+    printf("  %u roots learned.\n", table ? spx_root_table_count(table) : 0);
+    spx_root_table_close(table);
+
+    printf("Testing a shared table.. \n");
+    snprintf(name, sizeof name, "/spx-roottable-test-%ld", (long)getpid());
+    shm_unlink(name);
+    table = spx_root_table_open_shared(name, pk, TABLE_ENTRIES);
+    table2 = spx_root_table_open_shared(name, pk, TABLE_ENTRIES);
+    if (!table || !table2) {
+        printf("  X opening %s failed!\n", name);
+        ret = -1;
+    } else {
+        if (check_table(table, sk)) {
+            ret = -1;
+        }
+        /* Anything the first handle learned, the second one sees */
+        if (spx_root_table_count(table2) == 0 ||
+            spx_root_table_count(table2) != spx_root_table_count(table)) {
+            printf("  X the roots were not shared!\n");
+            ret = -1;
+        }
+        if (check_table(table2, sk)) {
+            ret = -1;
+        }
+        printf("  %u roots learned.\n", spx_root_table_count(table2));
+    }
+    spx_root_table_close(table);
+    spx_root_table_close(table2);
+
+    table = spx_root_table_open_shared(name, other_pk, TABLE_ENTRIES);
+    if (table) {
+        printf("  X opened the table with another public key!\n");
+        spx_root_table_close(table);
+        ret = -1;
+    }
+    shm_unlink(name);
+
+    /* A segment that others can write to must not be trusted, even if */
+    /* it looks right */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || fchmod(fd, 0622)) {
+        printf("  X creating %s failed!\n", name);
+        ret = -1;
+    } else {
+        table = spx_root_table_open_shared(name, pk, TABLE_ENTRIES);
+        if (table) {
+            printf("  X opened a world writable table!\n");
+            spx_root_table_close(table);
+            ret = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    shm_unlink(name);
+
+    /* One whose creator is alive is left alone for as long as it takes */
+    {
+        struct slow_creator creator;
+        pthread_t thread;
+
+        creator.name = name;
+        creator.replaced = 0;
+        creator.fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (creator.fd < 0 || flock(creator.fd, LOCK_EX) ||
+            pthread_create(&thread, 0, run_slow_creator, &creator)) {
+            printf("  X creating %s failed!\n", name);
+            ret = -1;
+        } else {
+            /* Once it gives up, we take over */
+            table = spx_root_table_open_shared(name, pk, TABLE_ENTRIES);
+            pthread_join(thread, 0);
+            if (creator.replaced) {
+                printf("  X replaced the table of a live creator!\n");
+                ret = -1;
+            }
+            if (!table || check_table(table, sk)) {
+                printf("  X taking over from a slow creator failed!\n");
+                ret = -1;
+            }
+            spx_root_table_close(table);
+        }
+        shm_unlink(name);
+    }
+
+    /* One whose creator never got around to setting it up is replaced */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        printf("  X creating %s failed!\n", name);
+        ret = -1;
+    } else {
+        close(fd);
+        table = spx_root_table_open_shared(name, pk, TABLE_ENTRIES);
+        if (!table || check_table(table, sk)) {
+            printf("  X recovering a stale table failed!\n");
+            ret = -1;
+        }
+        spx_root_table_close(table);
+    }
+    shm_unlink(name);
+
+    if (ret == 0) {
+        printf("successful.\n");
+    }
+    return ret;
+}
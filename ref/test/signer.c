@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../api.h"
+#include "../params.h"
+#include "../randombytes.h"
+#include "../signer.h"
+#include "../context.h"
+#include "../prf.h"
+
+#define SPX_MLEN 32
+#define SPX_SIGNATURES 4
+
+/* Cache the top tree and (some of) the trees directly below it */
+#define CACHE_TREES (1 + ((1 << SPX_TREE_HEIGHT) < 4 ? (1 << SPX_TREE_HEIGHT) : 4))
+
+/*
+ * Set the token (from another thread) shortly after the signing or key
+ * generation has started
+ */
+static void *cancel_later(void *arg)
+{
+    struct timespec delay = { 0, 1000000 };
+
+    nanosleep(&delay, 0);
+    __atomic_store_n((int *)arg, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+    int i;
+
+    /* Make stdout buffer more responsive. */
+    setbuf(stdout, NULL);
+
+    unsigned char pk[SPX_PK_BYTES];
+    unsigned char sk[SPX_SK_BYTES];
+    unsigned char m[SPX_MLEN];
+    unsigned char *sig = malloc(SPX_BYTES);
+    size_t siglen;
+    struct spx_signer *signer;
+    struct timespec delay = { 0, 10000000 };
+    uint64_t tree = 0;
+
+    printf("Generating keypair.. ");
+
+    if (crypto_sign_keypair(pk, sk)) {
+        printf("failed!\n");
+        return -1;
+    }
+    printf("successful.\n");
+
+    /* An absurd cache size must be refused, not wrap around */
+    if (spx_signer_create(sk, ~0u)) {
+        printf("Creating a signer with 2^32-1 trees succeeded!\n");
+        ret = -1;
+    }
+
+    signer = spx_signer_create(sk, CACHE_TREES);
+    if (!signer || spx_signer_start_warming(signer)) {
+        printf("Creating signer failed!\n");
+        return -1;
+    }
+
+    printf("Testing %d signatures while warming.. \n", SPX_SIGNATURES);
+    for (i = 0; i < SPX_SIGNATURES; i++) {
+        randombytes(m, SPX_MLEN);
+        if (spx_signer_sign(signer, sig, &siglen, m, SPX_MLEN) ||
+            crypto_sign_verify(sig, siglen, m, SPX_MLEN, pk)) {
+            printf("  X signature %d failed!\n", i);
+            ret = -1;
+        }
+    }
+
+    while (spx_signer_cached_trees(signer) < CACHE_TREES) {
+        nanosleep(&delay, 0);
+    }
+    printf("Cached %u trees.\n", spx_signer_cached_trees(signer));
+
+    printf("Testing %d signatures with a warm cache.. \n", SPX_SIGNATURES);
+    for (i = 0; i < SPX_SIGNATURES; i++) {
+        randombytes(m, SPX_MLEN);
+        if (spx_signer_sign(signer, sig, &siglen, m, SPX_MLEN) ||
+            crypto_sign_verify(sig, siglen, m, SPX_MLEN, pk)) {
+            printf("  X signature %d failed!\n", i);
+            ret = -1;
+        }
+    }
+
+    printf("Testing split phase signing.. \n");
+    for (i = 0; i < SPX_SIGNATURES; i++) {
+        struct spx_prepared prepared;
+
+        randombytes(m, SPX_MLEN);
+        spx_sign_prepare(&prepared, m, SPX_MLEN, sk);
+        if (spx_sign_complete(sig, &siglen, &prepared, sk) ||
+            crypto_sign_verify(sig, siglen, m, SPX_MLEN, pk)) {
+            printf("  X signature %d failed!\n", i);
+            ret = -1;
+        }
+        if (spx_signer_complete(signer, sig, &siglen, &prepared) ||
+            crypto_sign_verify(sig, siglen, m, SPX_MLEN, pk)) {
+            printf("  X signature %d (with the signer) failed!\n", i);
+            ret = -1;
+        }
+
+        /* A path hash_message can't produce must be refused */
+        prepared.idx_leaf = 1 << SPX_TREE_HEIGHT;
+        if (!spx_sign_complete(sig, &siglen, &prepared, sk)) {
+            printf("  X signed with an invalid leaf!\n");
+            ret = -1;
+        }
+    }
+
+    printf("Testing memoized PRF keys.. \n");
+    for (i = 0; i < 3 * SPX_SIGNATURES; i++) {
+        spx_ctx memo_ctx, ctx;
+        uint32_t idx_leaf;
+
+        /* A new path, then one that shares all but the bottom tree with */
+        /* it, then one that shares just the upper half */
+        if (i % 3 == 0) {
+            randombytes((unsigned char *)&tree, sizeof tree);
+            tree >>= 64 - SPX_TREE_HEIGHT * (SPX_D - 1);
+        } else if (i % 3 == 1) {
+            tree ^= 1;
+        } else {
+            tree ^= (uint64_t)1 << (SPX_TREE_HEIGHT * (SPX_D - 1) / 2);
+        }
+        randombytes((unsigned char *)&idx_leaf, sizeof idx_leaf);
+        idx_leaf &= (1 << SPX_TREE_HEIGHT) - 1;
+
+        memcpy(ctx.sk_seed, sk, 3*SPX_N);
+        memcpy(ctx.pub_seed, sk + 4*SPX_N, SPX_N);
+        memo_ctx = ctx;
+        initialize_prf_key(tree, idx_leaf, &ctx);
+        spx_signer_prf_keys(signer, tree, idx_leaf, &memo_ctx);
+        if (memcmp(ctx.merkle_key, memo_ctx.merkle_key,
+                   sizeof ctx.merkle_key) ||
+            memcmp(ctx.fors_seed, memo_ctx.fors_seed, sizeof ctx.fors_seed)) {
+            printf("  X keys %d differ!\n", i);
+            ret = -1;
+        }
+    }
+
+    printf("Testing cancellation.. \n");
+    {
+        struct spx_prepared prepared;
+        unsigned char seed[CRYPTO_SEEDBYTES];
+        unsigned char *zero = calloc(1, SPX_BYTES);
+        pthread_t canceller;
+        int cancel = 0;
+
+        randombytes(m, SPX_MLEN);
+        spx_sign_prepare(&prepared, m, SPX_MLEN, sk);
+
+        /* A token that is never set changes nothing */
+        if (spx_sign_complete_cancellable(sig, &siglen, &prepared, sk,
+                                          &cancel) ||
+            crypto_sign_verify(sig, siglen, m, SPX_MLEN, pk)) {
+            printf("  X signing with an unset token failed!\n");
+            ret = -1;
+        }
+
+        /* Once it's set, we get nothing back */
+        cancel = 1;
+        if (spx_sign_complete_cancellable(sig, &siglen, &prepared, sk,
+                                          &cancel) != SPX_CANCELLED ||
+            siglen != 0 || memcmp(sig, zero, SPX_BYTES)) {
+            printf("  X cancelled signing returned a signature!\n");
+            ret = -1;
+        }
+        if (spx_signer_complete_cancellable(signer, sig, &siglen, &prepared,
+                                            &cancel) != SPX_CANCELLED ||
+            siglen != 0 || memcmp(sig, zero, SPX_BYTES)) {
+            printf("  X cancelled signing (with the signer) returned a "
+                   "signature!\n");
+            ret = -1;
+        }
+
+        /* And the same if it's set by another thread while we're busy */
+        cancel = 0;
+        if (pthread_create(&canceller, 0, cancel_later, &cancel)) {
+            printf("  X pthread_create failed!\n");
+            return -1;
+        }
+        if (spx_sign_complete_cancellable(sig, &siglen, &prepared, sk,
+                                          &cancel) != SPX_CANCELLED ||
+            siglen != 0 || memcmp(sig, zero, SPX_BYTES)) {
+            printf("  X signing cancelled midway returned a signature!\n");
+            ret = -1;
+        }
+        pthread_join(canceller, 0);
+
+        randombytes(seed, CRYPTO_SEEDBYTES);
+        cancel = 0;
+        if (pthread_create(&canceller, 0, cancel_later, &cancel)) {
+            printf("  X pthread_create failed!\n");
+            return -1;
+        }
+        if (spx_seed_keypair_cancellable(pk, sk, seed, &cancel) !=
+                                                          SPX_CANCELLED ||
+            memcmp(sk, zero, SPX_SK_BYTES)) {
+            printf("  X key generation cancelled midway returned a key!\n");
+            ret = -1;
+        }
+        pthread_join(canceller, 0);
+        free(zero);
+    }
+
+    spx_signer_destroy(signer);
+    free(sig);
+
+    if (ret == 0) {
+        printf("successful.\n");
+    }
+    return ret;
+}
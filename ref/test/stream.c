@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../api.h"
+#include "../params.h"
+#include "../randombytes.h"
+#include "../streamverify.h"
+
+#define SPX_MLEN 32
+#define SPX_SIGNATURES 3
+
+/*
+ * Feed the signature to a stream verifier in random sized chunks (most of
+ * them not a multiple of SPX_N)
+ */
+static int stream_verify(const unsigned char *sig, size_t siglen,
+                         const unsigned char *m, const unsigned char *pk)
+{
+    struct spx_verify_stream *stream = spx_verify_stream_create(m, SPX_MLEN,
+                                                                pk);
+    unsigned char r;
+    size_t offset, len;
+    int ret = 0;
+
+    if (!stream) return -1;
+    for (offset = 0; offset < siglen; offset += len) {
+        randombytes(&r, 1);
+        len = (size_t)r + 1;
+        if (len > siglen - offset) {
+            len = siglen - offset;
+        }
+        if (spx_verify_stream_update(stream, sig + offset, len)) {
+            ret = -1;
+        }
+    }
+    if (spx_verify_stream_final(stream)) {
+        ret = -1;
+    }
+    spx_verify_stream_destroy(stream);
+    return ret;
+}
+
+int main(void)
+{
+    int ret = 0;
+    int i;
+
+    /* Make stdout buffer more responsive. */
+    setbuf(stdout, NULL);
+
+    unsigned char pk[SPX_PK_BYTES];
+    unsigned char sk[SPX_SK_BYTES];
+    unsigned char m[SPX_MLEN];
+    unsigned char *sig = malloc(SPX_BYTES + 1);
+    size_t siglen;
+
+    sig[SPX_BYTES] = 0;
+
+    printf("Generating keypair.. ");
+    if (crypto_sign_keypair(pk, sk)) {
+        printf("failed!\n");
+        return -1;
+    }
+    printf("successful.\n");
+
+    printf("Testing %d signatures.. \n", SPX_SIGNATURES);
+    for (i = 0; i < SPX_SIGNATURES; i++) {
+        randombytes(m, SPX_MLEN);
+        crypto_sign_signature(sig, &siglen, m, SPX_MLEN, sk);
+
+        if (stream_verify(sig, siglen, m, pk)) {
+            printf("  X signature %d failed!\n", i);
+            ret = -1;
+        }
+        if (!stream_verify(sig, siglen - 1, m, pk) ||
+            !stream_verify(sig, siglen + 1, m, pk)) {
+            printf("  X signature %d verified with the wrong length!\n", i);
+            ret = -1;
+        }
+
+        /* Flip a bit in the last auth path node */
+        sig[siglen - 1] ^= 1;
+        if (!stream_verify(sig, siglen, m, pk)) {
+            printf("  X tampered signature %d verified!\n", i);
+            ret = -1;
+        }
+    }
+    free(sig);
+
+    if (ret == 0) {
+        printf("successful.\n");
+    }
+    return ret;
+}
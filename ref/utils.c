@@ -5,6 +5,8 @@
 #include "hash.h"
 #include "thash.h"
 #include "address.h"
+#include "f-plain.h"
+#include "f-threshold.h"
 
 /**
  * Converts the value of 'in' to 'outlen' bytes in big-endian byte order.
@@ -43,9 +45,23 @@ unsigned long long bytes_to_ull(const unsigned char *in, unsigned int inlen)
     return retval;
 }
 
+/**
+ * Returns nonzero if the cancellation token in ctx (if any) has been set.
+ * The token is written by another thread, hence the atomic load; we don't
+ * need any ordering, just to see the store reasonably promptly
+ */
+int spx_cancelled(const spx_ctx *ctx)
+{
+    return ctx->cancel && __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED);
+}
+
 /**
  * Computes a root node given a leaf and an auth path.
  * Expects address to be complete other than the tree_height and tree_index.
+ *
+ * This keeps the two children in lane format within a SHAKE256 state
+ * that we set up once; each level only updates the tree height/index lane
+ * and the auth path node, and then does a single permutation
  */
 void compute_root(unsigned char *root, const unsigned char *leaf,
                   uint32_t leaf_idx, uint32_t idx_offset,
@@ -53,17 +69,21 @@ void compute_root(unsigned char *root, const unsigned char *leaf,
                   const spx_ctx *ctx, uint32_t addr[8])
 {
     uint32_t i;
-    unsigned char buffer[2 * SPX_N];
+    uint64_t state[25];
+    uint64_t *left = &state[PLAIN_VALUE_OFFSET];
+    uint64_t *right = &state[PLAIN_VALUE_OFFSET + SPX_N/8];
+
+    set_up_plain_block(state, ctx, addr, 2);
 
     /* If leaf_idx is odd (last bit = 1), current path element is a right child
        and auth_path has to go left. Otherwise it is the other way around. */
     if (leaf_idx & 1) {
-        memcpy(buffer + SPX_N, leaf, SPX_N);
-        memcpy(buffer, auth_path, SPX_N);
+        set_plain_value(state, 1, leaf);
+        set_plain_value(state, 0, auth_path);
     }
     else {
-        memcpy(buffer, leaf, SPX_N);
-        memcpy(buffer + SPX_N, auth_path, SPX_N);
+        set_plain_value(state, 0, leaf);
+        set_plain_value(state, 1, auth_path);
     }
     auth_path += SPX_N;
 
@@ -73,15 +93,16 @@ void compute_root(unsigned char *root, const unsigned char *leaf,
         /* Set the address of the node we're creating. */
         set_tree_height(addr, i + 1);
         set_tree_index(addr, leaf_idx + idx_offset);
+        update_plain_tree_addr(state, addr);
 
         /* Pick the right or left neighbor, depending on parity of the node. */
         if (leaf_idx & 1) {
-            thash(buffer + SPX_N, buffer, 2, ctx, addr);
-            memcpy(buffer, auth_path, SPX_N);
+            plain_hash(right, state);
+            set_plain_value(state, 0, auth_path);
         }
         else {
-            thash(buffer, buffer, 2, ctx, addr);
-            memcpy(buffer + SPX_N, auth_path, SPX_N);
+            plain_hash(left, state);
+            set_plain_value(state, 1, auth_path);
         }
         auth_path += SPX_N;
     }
@@ -91,7 +112,9 @@ void compute_root(unsigned char *root, const unsigned char *leaf,
     idx_offset >>= 1;
     set_tree_height(addr, tree_height);
     set_tree_index(addr, leaf_idx + idx_offset);
-    thash(root, buffer, 2, ctx, addr);
+    update_plain_tree_addr(state, addr);
+    plain_hash(left, state);
+    untransform_f(root, left);
 }
 
 /**
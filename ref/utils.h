@@ -32,6 +32,12 @@ void u32_to_bytes(unsigned char *out, uint32_t in);
 #define bytes_to_ull SPX_NAMESPACE(bytes_to_ull)
 unsigned long long bytes_to_ull(const unsigned char *in, unsigned int inlen);
 
+/**
+ * Returns nonzero if the cancellation token in ctx (if any) has been set
+ */
+#define spx_cancelled SPX_NAMESPACE(spx_cancelled)
+int spx_cancelled(const spx_ctx *ctx);
+
 /**
  * Computes a root node given a leaf and an auth path.
  * Expects address to be complete other than the tree_height and tree_index.
@@ -19,8 +19,12 @@
  * it is possible to continue counting indices across trees.
  *
  * This works by using the standard Merkle tree building algorithm,
+ *
+ * Returns 0, or SPX_CANCELLED if the cancellation token in ctx was set
+ * (which we check before and after each leaf; gen_leaf may give up on a
+ * leaf halfway once it is set)
  */
-void treehashx1(unsigned char *root, unsigned char *auth_path,
+int treehashx1(unsigned char *root, unsigned char *auth_path,
                 const spx_ctx* ctx,
                 uint32_t leaf_idx, uint32_t idx_offset,
                 uint32_t tree_height,
@@ -40,8 +44,17 @@ void treehashx1(unsigned char *root, unsigned char *auth_path,
         unsigned char current[2*SPX_N];   /* Current logical node is at */
             /* index[SPX_N].  We do this to minimize the number of copies */
             /* needed during a thash */
+        if (spx_cancelled(ctx)) {
+            memset( stack, 0, tree_height*SPX_N );
+            return SPX_CANCELLED;
+        }
         gen_leaf( &current[SPX_N], ctx, idx + idx_offset,
                     info );
+        if (spx_cancelled(ctx)) {
+            memset( stack, 0, tree_height*SPX_N );
+            memset( current, 0, sizeof current );
+            return SPX_CANCELLED;
+        }
 
         /* Now combine the freshly generated right node with previously */
         /* generated left ones */
@@ -55,7 +68,7 @@ void treehashx1(unsigned char *root, unsigned char *auth_path,
             if (h == tree_height) {
                 /* We hit the root; return it */
                 memcpy( root, &current[SPX_N], SPX_N );
-                return;
+                return 0;
             }
 
             /*
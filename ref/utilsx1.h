@@ -12,9 +12,11 @@
  * tree type (i.e. SPX_ADDR_TYPE_HASHTREE or SPX_ADDR_TYPE_FORSTREE).
  * Applies the offset idx_offset to indices before building addresses, so that
  * it is possible to continue counting indices across trees.
+ * Returns 0, or SPX_CANCELLED if the cancellation token in ctx was set
+ * (checked before each leaf)
  */
 #define treehashx1 SPX_NAMESPACE(treehashx1)
-void treehashx1(unsigned char *root, unsigned char *auth_path,
+int treehashx1(unsigned char *root, unsigned char *auth_path,
                 const spx_ctx* ctx,
                 uint32_t leaf_idx, uint32_t idx_offset, uint32_t tree_height,
                 void (*gen_leaf)(
@@ -9,6 +9,8 @@
 #include "wotsx1.h"
 #include "address.h"
 #include "params.h"
+#include "f-plain.h"
+#include "f-threshold.h"
 
 // TODO clarify address expectations, and make them more uniform.
 // TODO i.e. do we expect types to be set already?
@@ -20,21 +22,30 @@
  *
  * Interprets in as start-th value of the chain.
  * addr has to contain the address of the chain.
+ *
+ * This is only used on the verification path, so it need not be masked.
+ * We set up the SHAKE256 state once, and then each step is a single
+ * permutation, with the running value kept in lane format
  */
 static void gen_chain(unsigned char *out, const unsigned char *in,
                       unsigned int start, unsigned int steps,
                       const spx_ctx *ctx, uint32_t addr[8])
 {
+    uint64_t state[25];
     uint32_t i;
 
-    /* Initialize out with the value at position 'start'. */
-    memcpy(out, in, SPX_N);
+    /* Initialize the state with the value at position 'start'. */
+    set_hash_addr(addr, start);
+    set_up_plain_block(state, ctx, addr, 1);
+    set_plain_value(state, 0, in);
 
     /* Iterate 'steps' calls to the hash function. */
     for (i = start; i < (start+steps) && i < SPX_WOTS_W; i++) {
-        set_hash_addr(addr, i);
-        thash(out, out, 1, ctx, addr);
+        plain_hash(&state[PLAIN_VALUE_OFFSET], state);
+        increment_hash_addr_in_plain_block(state);
     }
+
+    untransform_f(out, &state[PLAIN_VALUE_OFFSET]);
 }
 
 /**
@@ -90,6 +101,18 @@ void chain_lengths(unsigned int *lengths, const unsigned char *msg)
     wots_checksum(lengths + SPX_WOTS_LEN1, lengths);
 }
 
+/**
+ * Takes one chain of a WOTS signature (which is the value at position
+ * 'start' of the chain), and hashes it to the top of the chain.
+ * addr has to contain the address of the chain.
+ */
+void wots_chain_from_sig(unsigned char *out, const unsigned char *sig,
+                         unsigned int start,
+                         const spx_ctx *ctx, uint32_t addr[8])
+{
+    gen_chain(out, sig, start, SPX_WOTS_W - 1 - start, ctx, addr);
+}
+
 /**
  * Takes a WOTS signature and an n-byte message, computes a WOTS public key.
  *
@@ -22,4 +22,14 @@ void wots_pk_from_sig(unsigned char *pk,
 #define chain_lengths SPX_NAMESPACE(chain_lengths)
 void chain_lengths(unsigned int *lengths, const unsigned char *msg);
 
+/*
+ * Takes one chain of a WOTS signature (the value at position 'start' of the
+ * chain) and hashes it to the top of the chain.  addr has to contain the
+ * address of the chain
+ */
+#define wots_chain_from_sig SPX_NAMESPACE(wots_chain_from_sig)
+void wots_chain_from_sig(unsigned char *out, const unsigned char *sig,
+                         unsigned int start,
+                         const spx_ctx *ctx, uint32_t addr[8]);
+
 #endif
@@ -9,6 +9,126 @@
 #include "address.h"
 #include "params.h"
 #include "f-threshold.h"
+#include "f-coalesce.h"
+
+/* The number of words a captured (still blinded) chain value takes */
+#define CAPTURE_WORDS (3*SPX_N/8)
+
+/*
+ * This walks a single WOTS chain, starting with the PRF output (in threshold
+ * format) and ending at the top of the chain
+ * If wots_k is a step within the chain, the value at that step is written
+ * to sig_value, still in threshold format (CAPTURE_WORDS words); the caller
+ * unblinds all the values it captured together, with unmask_f_values
+ * The top of the chain is written to top_value
+ */
+static void walk_wots_chain(uint64_t *sig_value, unsigned char *top_value,
+                            const unsigned char *prf_value, uint32_t wots_k,
+                            const spx_ctx *ctx, uint32_t leaf_addr[8])
+{
+    uint64_t chain_state[3*25];
+    int not_last_f;
+    unsigned value_offset;
+    unsigned k;
+
+    /* Fill in the values for the initial chain state */
+    value_offset = set_up_f_block( chain_state, prf_value, ctx, leaf_addr );
+    not_last_f = 1;  /* We will clear this when we compute the very */
+                     /* last F function for this chain */
+
+    /* Iterate down the WOTS chain */
+    for (k=0;; k++) {
+        /* Check if this is the value that needs to be saved as a */
+        /* part of the WOTS signature */
+        if (k == wots_k) {
+            memcpy( &sig_value[0], &chain_state[value_offset], SPX_N );
+            if (not_last_f) {
+                /*
+                 * We're in the middle of the chain; the value is still
+                 * blinded.  Keep all the shares
+                 */
+                memcpy( &sig_value[SPX_N/8], &chain_state[value_offset+25],
+                        SPX_N );
+                memcpy( &sig_value[2*SPX_N/8], &chain_state[value_offset+50],
+                        SPX_N );
+            } else {
+                /*
+                 * We're at the top; the value was unblinded, so the other
+                 * shares are 0
+                 */
+                memset( &sig_value[SPX_N/8], 0, 2*SPX_N );
+            }
+        }
+
+        /* Check if we hit the top of the chain */
+        if (!not_last_f) break;
+
+        /* Check if this is the last computation on the chain */
+        if (k == SPX_WOTS_W - 2) not_last_f = 0;
+
+        /* Iterate one step on the chain */
+        f_transform( chain_state, not_last_f );
+
+        /* And (for next time) increment the hash address field in the */
+        /* ADRS structure within the chain state */
+        increment_hash_addr_in_chain_state(chain_state);
+    }
+
+    /*
+     * The chain state has the result as a series of uint64_t's
+     * Convert that back into a byte string, and place it into the
+     * buffer of top chain values
+     */
+    untransform_f( top_value, &chain_state[value_offset] );
+}
+
+#if defined(SPX_FAULT_CHECK)
+/*
+ * This recomputes the chain we just used to generate part of the WOTS
+ * signature.  To make this an independent computation, we rederive the
+ * secret from the root of the PRF tree (rather than trusting the iterator),
+ * and then walk the chain again.  If the two don't agree, someone has been
+ * messing with our computation, and we must not release the signature
+ * Returns nonzero on a mismatch
+ */
+static int check_wots_chain(const unsigned char *prf_value,
+                            const uint64_t *sig_value,
+                            const unsigned char *top_value,
+                            uint32_t wots_k, unsigned prf_node,
+                            const spx_ctx *ctx, uint32_t leaf_addr[8],
+                            const struct prf_iter *iter)
+{
+    unsigned char prf_check[3*SPX_N];
+    uint64_t capture_check[CAPTURE_WORDS];
+    unsigned char sig_bytes[SPX_N];
+    unsigned char sig_check[SPX_N];
+    unsigned char top_check[SPX_N];
+    uint32_t prf_addr[8];
+    unsigned char diff = 0;
+    unsigned i;
+
+    memcpy( prf_addr, iter->addr, sizeof prf_addr );
+    eval_single_prf_leaf( prf_check, iter->node_value[0], prf_node,
+                          (SPX_WOTS_LEN+1) * (1 << SPX_TREE_HEIGHT),
+                          ctx, prf_addr );
+    walk_wots_chain( capture_check, top_check, prf_check, wots_k,
+                     ctx, leaf_addr );
+
+    /* The two computations blind the value differently; compare what */
+    /* they unblind to */
+    unmask_f_values( sig_check, capture_check, 1 );
+    unmask_f_values( sig_bytes, sig_value, 1 );
+
+    for (i=0; i<3*SPX_N; i++) {
+        diff |= prf_check[i] ^ prf_value[i];
+    }
+    for (i=0; i<SPX_N; i++) {
+        diff |= (sig_check[i] ^ sig_bytes[i]) | (top_check[i] ^ top_value[i]);
+    }
+
+    return diff != 0;
+}
+#endif
 
 /*
  * This generates a WOTS public key
@@ -21,10 +141,20 @@ void wots_gen_leafx1(unsigned char *dest,
     struct leaf_info_x1 *info = v_info;
     uint32_t *leaf_addr = info->leaf_addr;
     uint32_t *pk_addr = info->pk_addr;
-    unsigned int i, k;
+    unsigned int i;
     unsigned char pk_buffer[ SPX_WOTS_BYTES ];
     unsigned char *buffer;
     uint32_t wots_k_mask;
+    uint64_t discard[CAPTURE_WORDS];
+    /* If we're signing, the (blinded) chain values we reveal */
+    uint64_t captured[SPX_WOTS_LEN][CAPTURE_WORDS];
+#if defined(SPX_F_COALESCE)
+    /* We set all the chains up, and then walk them together */
+    struct f_job jobs[SPX_WOTS_LEN];
+#if defined(SPX_FAULT_CHECK)
+    unsigned char prf_values[SPX_WOTS_LEN][3*SPX_N];
+#endif
+#endif
 
     if (leaf_idx == info->wots_sign_leaf) {
         /* We're traversing the leaf that's signing; generate the WOTS */
@@ -41,10 +171,18 @@ void wots_gen_leafx1(unsigned char *dest,
     for (i = 0, buffer = pk_buffer; i < SPX_WOTS_LEN; i++, buffer += SPX_N) {
         uint32_t wots_k = info->wots_steps[i] | wots_k_mask; /* Set wots_k to */
             /* the step if we're generating a signature, ~0 if we're not */
-	uint64_t chain_state[3*25];
-	int not_last_f;
-	unsigned value_offset;
-	unsigned char temp_buffer[3*SPX_N];
+        unsigned char temp_buffer[3*SPX_N];
+        uint64_t *sig_value;
+
+#if !defined(SPX_F_COALESCE)
+        /* The chains are where the time goes, so we check for */
+        /* cancellation before each; our caller will notice too, and throw */
+        /* the leaf away */
+        if (spx_cancelled( ctx )) {
+            memset( captured, 0, sizeof captured );
+            return;
+        }
+#endif
 
         /* Start with the secret seed; get it from our iterator */
         next_prf_iter( temp_buffer, &info->merkle_iter );
@@ -53,63 +191,62 @@ void wots_gen_leafx1(unsigned char *dest,
         set_chain_addr(leaf_addr, i);
         set_hash_addr(leaf_addr, 0);
 
-	/* Fill in the values for the initial chain state */
-	value_offset = set_up_f_block( chain_state, temp_buffer, ctx, leaf_addr );
-	not_last_f = 1;  /* We will clear this when we compute the very */
-	                 /* last F function for this chain */
-
-        /* Iterate down the WOTS chain */
-        for (k=0;; k++) {
-            /* Check if this is the value that needs to be saved as a */
-            /* part of the WOTS signature */
-            if (k == wots_k) {
-		uint64_t output_buffer[SPX_N/8];
-		const uint64_t *value;
-		if (not_last_f) {
-		    /*
-		     * We're in the middle of the chain; the value is still
-		     * blinded.  Unblind it
-		     */
-		    for (unsigned m=0; m<SPX_N/8; m++) {
-			output_buffer[m] = chain_state[m+value_offset] ^
-				           chain_state[m+value_offset+25] ^
-					   chain_state[m+value_offset+50];
-		     }
-		     value = output_buffer;
-		} else {
-                     /*
-		      * We're at the top; the value was unblinded; no
-		      * unblinding is necessary
-		      */
-		     value = &chain_state[value_offset];
-		}
-		/*
-		 * The value is a series of uint64_t's; convert it into the
-		 * byte string that must appear in the signature
-		 */
-		untransform_f( info->wots_sig + i * SPX_N, value );
-            }
+        if (wots_k_mask == 0) {
+            sig_value = captured[i];
+        } else {
+            sig_value = discard;
+        }
+
+#if defined(SPX_F_COALESCE)
+        set_up_f_job( &jobs[i], temp_buffer, SPX_WOTS_W - 1, wots_k,
+                      sig_value, ctx, leaf_addr );
+#if defined(SPX_FAULT_CHECK)
+        memcpy( prf_values[i], temp_buffer, 3*SPX_N );
+#endif
+#else
+        walk_wots_chain( sig_value, buffer, temp_buffer, wots_k,
+                         ctx, leaf_addr );
 
-            /* Check if we hit the top of the chain */
-	    if (!not_last_f) break;
+#if defined(SPX_FAULT_CHECK)
+        if (wots_k_mask == 0) {
+            info->fault |= check_wots_chain( temp_buffer, sig_value, buffer,
+                                     wots_k, leaf_idx * SPX_WOTS_LEN + i,
+                                     ctx, leaf_addr, &info->merkle_iter );
+        }
+#endif
+#endif
+    }
 
-	    /* Check if this is the last computation on the chain */
-            if (k == SPX_WOTS_W - 2) not_last_f = 0;
+#if defined(SPX_F_COALESCE)
+    /* Walk all the chains of this leaf (along with whatever other threads */
+    /* are walking) */
+    coalesce_f_chains( jobs, SPX_WOTS_LEN );
 
-            /* Iterate one step on the chain */
-	    f_transform( chain_state, not_last_f );
+    for (i = 0, buffer = pk_buffer; i < SPX_WOTS_LEN; i++, buffer += SPX_N) {
+        untransform_f( buffer, &jobs[i].chain_state[jobs[i].value_offset] );
 
-	    /* And (for next time) increment the hash address field in the */
-	    /* ADRS structure within the chain state */
-            increment_hash_addr_in_chain_state(chain_state);
+#if defined(SPX_FAULT_CHECK)
+        if (wots_k_mask == 0) {
+            set_chain_addr(leaf_addr, i);
+            set_hash_addr(leaf_addr, 0);
+            info->fault |= check_wots_chain( prf_values[i], captured[i],
+                                     buffer, info->wots_steps[i],
+                                     leaf_idx * SPX_WOTS_LEN + i,
+                                     ctx, leaf_addr, &info->merkle_iter );
         }
+#endif
+    }
+    memset( jobs, 0, sizeof jobs );
+#if defined(SPX_FAULT_CHECK)
+    memset( prf_values, 0, sizeof prf_values );
+#endif
+#endif
 
-	/*
-	 * The chain state has the result as a series of uint64_t's
-	 * Convert that back into a byte string, and place it into the
-	 * buffer of top chain values
-	 */
-	untransform_f( buffer, &chain_state[value_offset] );
+    if (wots_k_mask == 0) {
+        /* Unblind all the values we captured, and write them out as the */
+        /* WOTS signature, in one pass; then wipe the shares */
+        unmask_f_values( info->wots_sig, &captured[0][0], SPX_WOTS_LEN );
+        memset( captured, 0, sizeof captured );
     }
 
     /* Do the final thash to generate the public keys */
@@ -17,6 +17,7 @@ struct leaf_info_x1 {
     uint32_t leaf_addr[8];
     uint32_t pk_addr[8];
     struct prf_iter merkle_iter; /* Iterator over the Merkle leaves */
+    int fault;   /* Set if SPX_FAULT_CHECK caught a miscomputed chain */
 };
 
 /* Macro to set the leaf_info to something 'benign', that is, it would */
@@ -26,6 +27,8 @@ struct leaf_info_x1 {
     info.wots_sig = 0;             \
     info.wots_sign_leaf = ~0u;      \
     info.wots_steps = step_buffer; \
+    info.fault = 0;                \
+    info.merkle_iter.pipeline = 0; \
     memcpy( &info.leaf_addr[0], addr, 32 ); \
     memcpy( &info.pk_addr[0], addr, 32 ); \
 }